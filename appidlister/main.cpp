@@ -17,6 +17,8 @@
 #include <KWindowSystem>
 #include <KX11Extras>
 
+#include "tracing.h"
+
 using namespace std::chrono_literals;
 
 class WaylandLister : public QObject
@@ -48,6 +50,8 @@ public:
         static constexpr auto syncTimes = 3;
         for (auto i = 0; i < syncTimes; i++) {
             QCoreApplication::processEvents();
+            Tracing::Span span("wayland", "roundtrip");
+            Tracing::count("wayland roundtrips");
             m_connection->roundtrip();
             QCoreApplication::processEvents();
         }
@@ -78,12 +82,14 @@ private:
 
 QVariantHash waylandPidsToAppIds()
 {
+    Tracing::Span span("wayland", "listWindows");
     WaylandLister lister;
     return lister.data();
 }
 
 QVariantHash x11PidsToAppIds()
 {
+    Tracing::Span span("x11", "listWindows");
     QVariantHash pidsToAppIds;
     const auto wids = KX11Extras::windows();
     for (const auto &wid : wids) {
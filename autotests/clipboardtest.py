@@ -4,6 +4,7 @@
 # SPDX-FileCopyrightText: 2023 Harald Sitter <sitter@kde.org>
 
 import base64
+import os
 import unittest
 
 from appium import webdriver
@@ -17,7 +18,7 @@ class SimpleCalculatorTests(unittest.TestCase):
         options = AppiumOptions()
         # unused actually but need one so the driver is happy
         options.set_capability("app", "Root")
-        self.driver = webdriver.Remote(command_executor='http://127.0.0.1:4723', options=options)
+        self.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
 
     @classmethod
     def tearDownClass(self):
@@ -37,6 +38,23 @@ class SimpleCalculatorTests(unittest.TestCase):
         text = base64.b64decode(base64_str).decode('utf-8')
         self.assertEqual(text, "qwer")
 
+    def test_mimeTypes(self):
+        html = "<b>bold</b>"
+        self.driver.execute_script("mobile: setClipboard", {'content': base64.b64encode(html.encode('utf-8')).decode('utf-8'), 'contentType': 'html'})
+        base64_str = self.driver.execute_script("mobile: getClipboard", {'contentType': 'text/html'})
+        self.assertEqual(base64.b64decode(base64_str).decode('utf-8'), html)
+
+        # Arbitrary binary data survives, and it's large enough to span many transfer chunks
+        data = os.urandom(4 * 1024 * 1024 + 1)
+        self.driver.set_clipboard(data, 'image')
+        self.assertEqual(base64.b64decode(self.driver.get_clipboard('image')), data)
+
+    def test_wrappedBase64(self):
+        # MIME encoders break lines every 76 characters
+        data = os.urandom(100 * 1024)
+        self.driver.execute_script("mobile: setClipboard", {'content': base64.encodebytes(data).decode('ascii'), 'contentType': 'image'})
+        self.assertEqual(base64.b64decode(self.driver.get_clipboard('image')), data)
+
 
 if __name__ == '__main__':
     unittest.main()
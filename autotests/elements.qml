@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+import QtQuick 2.15
+import QtQuick.Controls 2.15 as QQC2
+
+Column {
+    Repeater {
+        model: 8
+        QQC2.Button {
+            text: "button " + index
+        }
+    }
+}
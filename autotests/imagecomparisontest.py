@@ -26,7 +26,7 @@ class ImageComparisonTest(unittest.TestCase):
         options.set_capability("app", f"{os.getenv('QML_EXEC', '/usr/bin/qml6')} {os.path.dirname(os.path.realpath(__file__))}/imagecomparison.qml")
         options.set_capability("timeouts", {'implicit': 30000})
         # Boilerplate, always the same
-        cls.driver = webdriver.Remote(command_executor='http://127.0.0.1:4723', options=options)
+        cls.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
         time.sleep(3)  # Make sure the window appears in the screenshot
 
     @classmethod
@@ -49,10 +49,63 @@ class ImageComparisonTest(unittest.TestCase):
         self.assertEqual(result["rect"]["width"], cv_second_image.shape[1])
         self.assertEqual(result["rect"]["height"], cv_second_image.shape[0])
 
+        # Only searching a region of interest
+        result = self.driver.find_image_occurrence(first_image.decode(), second_image.decode(), roi={'x': 10, 'y': 20, 'width': 150, 'height': 150})
+        self.assertEqual(result["rect"]["x"], 10)
+        self.assertEqual(result["rect"]["y"], 20)
+        result = self.driver.find_image_occurrence(first_image.decode(), second_image.decode(), exhaustive=True)
+        self.assertEqual(result["rect"]["width"], cv_second_image.shape[1])
+        self.assertRaises(Exception, self.driver.find_image_occurrence, first_image.decode(), second_image.decode(), roi={'x': 10, 'y': 20, 'width': 50, 'height': 50})
+
         cv_second_image[:, :] = [0, 255, 0]  # Green, which doesn't exist in the screenshot
         second_image = base64.b64encode(cv.imencode('.png', cv_second_image)[1].tobytes())
         self.assertRaises(Exception, self.driver.find_image_occurrence, first_image.decode(), second_image.decode())
 
+    def test_getSimilarity(self) -> None:
+        cv_first_image = np.zeros((100, 200, 3), dtype=np.uint8)
+        cv_first_image[:, :] = [0, 0, 255]  # Red
+        first_image = base64.b64encode(cv.imencode('.png', cv_first_image)[1].tobytes())
+
+        result = self.driver.get_images_similarity(first_image, first_image)
+        self.assertAlmostEqual(result["score"], 1.0)
+
+        cv_second_image = cv_first_image.copy()
+        cv_second_image[:, 150:] = [0, 255, 0]  # A quarter green
+        second_image = base64.b64encode(cv.imencode('.png', cv_second_image)[1].tobytes())
+        result = self.driver.get_images_similarity(first_image, second_image)
+        self.assertLess(result["score"], 1.0)
+        self.assertGreater(result["score"], 0.0)
+
+        cv_second_image = np.zeros((50, 50, 3), dtype=np.uint8)  # Different size
+        second_image = base64.b64encode(cv.imencode('.png', cv_second_image)[1].tobytes())
+        self.assertRaises(Exception, self.driver.get_images_similarity, first_image, second_image)
+
+    def test_getChangedRegions(self) -> None:
+        cv_first_image = np.zeros((100, 200, 3), dtype=np.uint8)
+        cv_first_image[:, :] = [0, 0, 255]  # Red
+        first_image = base64.b64encode(cv.imencode('.png', cv_first_image)[1].tobytes()).decode()
+
+        cv_second_image = cv_first_image.copy()
+        cv_second_image[40:50, 70:75] = [0, 255, 0]  # A green spot
+        second_image = base64.b64encode(cv.imencode('.png', cv_second_image)[1].tobytes()).decode()
+
+        def changed_regions(second: str, options: dict) -> dict:
+            return self.driver.execute('compareImages', {'mode': 'getChangedRegions', 'firstImage': first_image, 'secondImage': second, 'options': options})['value']
+
+        result = changed_regions(first_image, {'tileSize': 32})
+        self.assertFalse(result["changed"])
+        self.assertEqual(result["rects"], [])
+
+        # Twice, the second time around the baseline comes from the cache
+        for _ in range(2):
+            result = changed_regions(second_image, {'tileSize': 32})
+            self.assertTrue(result["changed"])
+            self.assertEqual(result["rects"], [{'x': 64, 'y': 32, 'width': 32, 'height': 32}])
+
+        result = changed_regions(second_image, {'tileSize': 16, 'firstOnly': True})
+        self.assertTrue(result["changed"])
+        self.assertEqual(len(result["rects"]), 1)
+
 
 if __name__ == '__main__':
     unittest.main()
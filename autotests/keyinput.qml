@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+import QtQuick 2.15
+
+// Takes text through key events rather than a text field, so it never reports text insertions
+Text {
+    id: root
+    property string typed: ""
+
+    width: 400
+    height: 40
+    text: typed
+    focus: true
+    Accessible.role: Accessible.Button
+    Accessible.name: typed.length > 0 ? typed : "keys"
+    Accessible.focusable: true
+
+    Keys.onPressed: event => {
+        root.typed += event.text
+        event.accepted = true
+    }
+}
@@ -47,6 +47,12 @@ Item {
         onActiveChanged: if (active) result.text = "dragged"
     }
 
+    PinchHandler {
+        target: null
+        onActiveChanged: if (active) result.text = "pinched"
+        onRotationChanged: if (active && Math.abs(activeRotation) > 30) result.text = "rotated"
+    }
+
     WheelHandler {
         orientation: Qt.Vertical | Qt.Horizontal
         onWheel: wheel => result.text = `wheel ${wheel.angleDelta.x} ${wheel.angleDelta.y}`
@@ -28,7 +28,7 @@ class PointerInputTest(unittest.TestCase):
         options.set_capability("app", f"{os.getenv('QML_EXEC')} {os.path.dirname(os.path.realpath(__file__))}/pointerinput.qml")
         options.set_capability("timeouts", {'implicit': 10000})
         # Boilerplate, always the same
-        cls.driver = webdriver.Remote(command_executor='http://127.0.0.1:4723', options=options)
+        cls.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
         time.sleep(3)  # Make sure the window is visible
 
     @classmethod
@@ -101,6 +101,18 @@ class PointerInputTest(unittest.TestCase):
         action.perform()
         WebDriverWait(self.driver, 4).until(lambda x: element.text == "wheel 180 0")
 
+    def test_4_gesture(self) -> None:
+        element = self.driver.find_element(AppiumBy.NAME, "result")
+
+        self.driver.execute_script("mobile: pinchGesture", {'x': 400, 'y': 400, 'startSpan': 100, 'endSpan': 400, 'duration': 500})
+        WebDriverWait(self.driver, 4).until(lambda x: element.text == "pinched")
+
+        self.driver.execute_script("mobile: rotateGesture", {'x': 400, 'y': 400, 'startSpan': 200, 'angle': 90, 'duration': 500})
+        WebDriverWait(self.driver, 4).until(lambda x: element.text == "rotated")
+
+        self.driver.execute_script("mobile: swipeGesture", {'x': 200, 'y': 200, 'fingers': 1, 'deltaX': 200, 'deltaY': 200})
+        WebDriverWait(self.driver, 4).until(lambda x: element.text == "dragged")
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: MIT
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Encodes images from disk with the screenshotter (--input, no compositor needed) and checks that they decode back to
+# the same pixels.
+
+import base64
+import os
+import struct
+import subprocess
+import tempfile
+import unittest
+
+import cv2 as cv
+import numpy as np
+
+HELPER = os.getenv('SELENIUM_SCREENSHOTTER', 'selenium-webdriver-at-spi-screenshotter')
+ENV = dict(os.environ, QT_QPA_PLATFORM='offscreen')
+# QImage::Format_RGB32 and QImage::Format_ARGB32, what Qt loads RGB and RGBA PNGs as
+FORMAT_RGB32 = 4
+FORMAT_ARGB32 = 5
+
+
+def image(channels):
+    # Enough rows for several PNG strips, flat areas for the runs and noise for everything else
+    rng = np.random.default_rng(channels)
+    pixels = np.full((300, 257, channels), 200, np.uint8)
+    pixels[100:200] = rng.integers(0, 255, (100, 257, channels), np.uint8)
+    pixels[220:240, 10:50] = rng.integers(0, 255, channels)
+    pixels[250:] = np.arange(257, dtype=np.uint8)[None, :, None]
+    return pixels
+
+
+def decode_qoi(data):
+    # https://qoiformat.org/qoi-specification.pdf
+    width, height, channels = struct.unpack('>IIB', data[4:13])
+    pixels = bytearray()
+    index = [(0, 0, 0, 0)] * 64
+    pixel = (0, 0, 0, 255)
+    position = 14
+    while len(pixels) < width * height * 4:
+        byte = data[position]
+        position += 1
+        run = 1
+        if byte == 0xfe:
+            pixel = (*data[position:position + 3], pixel[3])
+            position += 3
+        elif byte == 0xff:
+            pixel = tuple(data[position:position + 4])
+            position += 4
+        elif byte >> 6 == 0:
+            pixel = index[byte]
+        elif byte >> 6 == 1:
+            pixel = ((pixel[0] + (byte >> 4 & 3) - 2) % 256, (pixel[1] + (byte >> 2 & 3) - 2) % 256,
+                     (pixel[2] + (byte & 3) - 2) % 256, pixel[3])
+        elif byte >> 6 == 2:
+            second = data[position]
+            position += 1
+            dg = (byte & 0x3f) - 32
+            pixel = ((pixel[0] + dg - 8 + (second >> 4)) % 256, (pixel[1] + dg) % 256,
+                     (pixel[2] + dg - 8 + (second & 0xf)) % 256, pixel[3])
+        else:
+            run = (byte & 0x3f) + 1
+        index[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64] = pixel
+        pixels += bytes(pixel) * run
+    if data[position:] != b'\0\0\0\0\0\0\0\1':
+        raise ValueError('no end marker after the pixels')
+    rgba = np.frombuffer(bytes(pixels), np.uint8).reshape(height, width, 4)
+    return rgba if channels == 4 else rgba[:, :, :3]
+
+
+class ScreenshotEncodeTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(self):
+        self.directory = tempfile.TemporaryDirectory()
+        self.images = {}
+        for channels in (3, 4):
+            path = os.path.join(self.directory.name, f'{channels}.png')
+            self.images[channels] = (path, image(channels))
+            cv.imwrite(path, self.images[channels][1])
+
+    @classmethod
+    def tearDownClass(self):
+        self.directory.cleanup()
+
+    def encode(self, path, *args):
+        proc = subprocess.run([HELPER, '--input', path, *args], env=ENV, stdout=subprocess.PIPE, check=True)
+        return base64.b64decode(proc.stdout)
+
+    def test_png(self):
+        for channels, (path, pixels) in self.images.items():
+            for level in (0, 1, 6, 9):
+                for threads in (1, 4):
+                    with self.subTest(channels=channels, level=level, threads=threads):
+                        data = self.encode(path, '--encoding', 'png', '--level', str(level), '--threads', str(threads))
+                        self.assertTrue(data.startswith(b'\x89PNG\r\n\x1a\n'))
+                        decoded = cv.imdecode(np.frombuffer(data, np.uint8), cv.IMREAD_UNCHANGED)
+                        np.testing.assert_array_equal(decoded, pixels)
+
+    def test_qoi(self):
+        for channels, (path, pixels) in self.images.items():
+            with self.subTest(channels=channels):
+                data = self.encode(path, '--encoding', 'qoi')
+                self.assertEqual(data[:4], b'qoif')
+                self.assertEqual(struct.unpack('>IIBB', data[4:14]), (257, 300, channels, 0))
+                # cv works in BGR(A), QOI in RGB(A)
+                np.testing.assert_array_equal(decode_qoi(data), pixels[:, :, [2, 1, 0, 3][:channels]])
+
+    def test_raw(self):
+        for channels, (path, pixels) in self.images.items():
+            with self.subTest(channels=channels):
+                data = self.encode(path, '--encoding', 'raw')
+                self.assertEqual(data[:4], b'SWRW')
+                width, height, stride, image_format = struct.unpack('<IIII', data[4:20])
+                self.assertEqual((width, height), (257, 300))
+                self.assertEqual(image_format, FORMAT_ARGB32 if channels == 4 else FORMAT_RGB32)
+                self.assertEqual(len(data), 20 + stride * height)
+                # 32 bit ARGB as little endian words is BGRA in memory, like cv
+                rows = np.frombuffer(data[20:], np.uint8).reshape(height, stride)[:, :width * 4].reshape(height, width, 4)
+                np.testing.assert_array_equal(rows[:, :, :channels], pixels)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -3,10 +3,12 @@
 # SPDX-License-Identifier: MIT
 # SPDX-FileCopyrightText: 2023 Harald Sitter <sitter@kde.org>
 
+import base64
 import os
 import unittest
 from appium import webdriver
 from appium.options.common.base import AppiumOptions
+from selenium.common.exceptions import InvalidArgumentException
 
 
 class ScreenshotTest(unittest.TestCase):
@@ -15,7 +17,7 @@ class ScreenshotTest(unittest.TestCase):
     def setUpClass(self):
         options = AppiumOptions()
         options.set_capability("app", f"{os.getenv('QML_EXEC')} {os.path.dirname(os.path.realpath(__file__))}/value.qml")
-        self.driver = webdriver.Remote(command_executor='http://127.0.0.1:4723', options=options)
+        self.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
 
     @classmethod
     def tearDownClass(self):
@@ -27,6 +29,25 @@ class ScreenshotTest(unittest.TestCase):
         st = os.stat("appium_artifact_{}.png".format(self.id()))
         self.assertGreater(st.st_size, 1000)
 
+    def test_visualStability(self):
+        result = self.driver.execute_script("mobile: waitForVisualStability", {"stableFor": 200, "timeout": 10000})
+        self.assertTrue(result["stable"])
+        self.assertLess(result["elapsed"], 10000)
+
+    def test_burst(self):
+        frames = self.driver.execute_script("mobile: burstScreenshots", {"count": 5, "interval": 50})
+        self.assertEqual(len(frames), 5)
+        self.assertEqual(frames[0]["timestamp"], 0)
+        timestamps = [frame["timestamp"] for frame in frames]
+        self.assertEqual(timestamps, sorted(timestamps))
+        self.assertGreaterEqual(timestamps[-1], 4 * 50)
+        for frame in frames:
+            self.assertTrue(base64.b64decode(frame["image"]).startswith(b"\x89PNG"))
+
+    def test_burstTooLong(self):
+        with self.assertRaises(InvalidArgumentException):
+            self.driver.execute_script("mobile: burstScreenshots", {"count": 100000})
+
 
 if __name__ == '__main__':
     unittest.main()
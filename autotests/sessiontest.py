@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: MIT
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+import json
+import os
+import re
+import unittest
+import urllib.request
+
+from appium import webdriver
+from appium.options.common.base import AppiumOptions
+from appium.webdriver.common.appiumby import AppiumBy
+from selenium.common.exceptions import InvalidSessionIdException, NoSuchElementException
+
+# The driver runs with SELENIUM_ELEMENT_STORE_SIZE=4, see CMakeLists.txt
+STORE_SIZE = 4
+SERVER = f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}"
+
+
+def metrics():
+    with urllib.request.urlopen(f"{SERVER}/metrics") as response:
+        lines = response.read().decode().splitlines()
+    samples = (line.rsplit(' ', 1) for line in lines if line and not line.startswith('#'))
+    return {name: float(value) for name, value in samples}
+
+
+class SessionTest(unittest.TestCase):
+
+    def setUp(self):
+        options = AppiumOptions()
+        options.set_capability("app", f"{os.getenv('QML_EXEC')} {os.path.dirname(os.path.realpath(__file__))}/elements.qml")
+        self.driver = webdriver.Remote(command_executor=SERVER, options=options)
+
+    def tearDown(self):
+        if self.driver:
+            self.driver.quit()
+
+    def test_eviction(self):
+        evictions = metrics()["selenium_webdriver_at_spi_element_evictions_total"]
+        buttons = [self.driver.find_element(AppiumBy.NAME, f"button {i}") for i in range(8)]
+        self.assertTrue(buttons[-1].is_enabled())
+        # The first ones were forgotten to make room for the later ones
+        with self.assertRaises(NoSuchElementException):
+            buttons[0].is_enabled()
+
+        values = metrics()
+        self.assertEqual(values["selenium_webdriver_at_spi_sessions"], 1)
+        self.assertEqual(values["selenium_webdriver_at_spi_elements"], STORE_SIZE)
+        self.assertEqual(values["selenium_webdriver_at_spi_element_evictions_total"] - evictions, 8 - STORE_SIZE)
+
+    def test_metrics(self):
+        self.driver.find_element(AppiumBy.NAME, "button 0")
+        with urllib.request.urlopen(f"{SERVER}/metrics") as response:
+            lines = response.read().decode().splitlines()
+        # https://prometheus.io/docs/instrumenting/exposition_formats/
+        sample = re.compile(r'[a-zA-Z_:][a-zA-Z0-9_:]*(\{([a-zA-Z_][a-zA-Z0-9_]*="([^"\\]|\\.)*",?)*\})? \S+')
+        for line in lines:
+            if line.startswith('#'):
+                self.assertRegex(line, r'^# (HELP|TYPE) ')
+            elif line:
+                self.assertTrue(sample.fullmatch(line), line)
+                float(line.rsplit(' ', 1)[1])
+        self.assertIn('selenium_webdriver_at_spi_span_seconds_count{category="request",name="POST /session/<session_id>/element"}',
+                      [line.rsplit(' ', 1)[0] for line in lines])
+
+    def test_trace(self):
+        self.driver.find_element(AppiumBy.NAME, "button 0")
+        with urllib.request.urlopen(f"{SERVER}/session/{self.driver.session_id}/trace") as response:
+            document = json.load(response)
+        self.assertEqual(document["otherData"]["session"], self.driver.session_id)
+        requests = [event["name"] for event in document["traceEvents"] if event.get("cat") == "request"]
+        self.assertIn("POST /session/<session_id>/element", requests)
+
+    def test_delete(self):
+        self.driver.find_element(AppiumBy.NAME, "button 0")
+        self.driver.quit()
+        driver, self.driver = self.driver, None
+        with self.assertRaises(InvalidSessionIdException):
+            driver.find_element(AppiumBy.NAME, "button 0")
+
+        values = metrics()
+        self.assertEqual(values["selenium_webdriver_at_spi_sessions"], 0)
+        self.assertEqual(values["selenium_webdriver_at_spi_elements"], 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
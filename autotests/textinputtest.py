@@ -23,7 +23,7 @@ class TextInputTest(unittest.TestCase):
         # The app capability may be a command line or a desktop file id.
         options.set_capability("app", f"{os.getenv('QML_EXEC')} {os.path.dirname(os.path.realpath(__file__))}/textinput.qml")
         # Boilerplate, always the same
-        self.driver = webdriver.Remote(command_executor='http://127.0.0.1:4723', options=options)
+        self.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
         # Set a timeout for waiting to find elements. If elements cannot be found
         # in time we'll get a test failure. This should be somewhat long so as to
         # not fall over when the system is under load, but also not too long that
@@ -68,5 +68,52 @@ class TextInputTest(unittest.TestCase):
         WebDriverWait(self.driver, 4).until(lambda x: element.text == "accepted")
         element.clear()
 
+    @unittest.skipUnless('KWIN_PID' in os.environ, "modifiers are coalesced by the inputsynth")
+    def test_mixedCase(self):
+        # Actions are always typed key by key. Shift stays down across the keys that need it and must be let go of
+        # exactly for those that don't, including when it is held explicitly.
+        element = self.driver.find_element(AppiumBy.NAME, "input")
+        ActionChains(self.driver).send_keys("Hello WORLD! aBcDe").perform()
+        WebDriverWait(self.driver, self.wait).until(lambda x: element.text == "Hello WORLD! aBcDe")
+        element.clear()
+        WebDriverWait(self.driver, self.wait).until(lambda x: element.text == "")
+
+        ActionChains(self.driver).key_down(Keys.SHIFT).send_keys("ab1").key_up(Keys.SHIFT).send_keys("cD").perform()
+        WebDriverWait(self.driver, self.wait).until(lambda x: element.text == "AB!cD")
+        element.clear()
+        WebDriverWait(self.driver, self.wait).until(lambda x: element.text == "")
+
+    @unittest.skipUnless('KWIN_PID' in os.environ, "the input method needs the nested KWin")
+    def test_inputMethod(self):
+        # The us layout has no keys for these, they can only arrive through the input method as a whole
+        element = self.driver.find_element(AppiumBy.NAME, "input")
+        element.send_keys("日本語のテキスト")
+        WebDriverWait(self.driver, self.wait).until(lambda x: element.text == "日本語のテキスト")
+        element.clear()
+        WebDriverWait(self.driver, self.wait).until(lambda x: element.text == "")
+
+
+class KeyInputTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(self):
+        options = AppiumOptions()
+        options.set_capability("app", f"{os.getenv('QML_EXEC')} {os.path.dirname(os.path.realpath(__file__))}/keyinput.qml")
+        self.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
+
+    @classmethod
+    def tearDownClass(self):
+        self.driver.quit()
+
+    def test_noInsertionEvents(self):
+        # The element never confirms the text through insertion events, typing must not wait for them on every key
+        element = self.driver.find_element(AppiumBy.NAME, "keys")
+        text = "the quick brown fox jumps over the lazy dog"
+        before_time = datetime.now().timestamp()
+        element.send_keys(text)
+        self.assertLess(datetime.now().timestamp() - before_time, 15)
+        WebDriverWait(self.driver, 4).until(lambda x: element.text == text)
+
+
 if __name__ == '__main__':
     unittest.main()
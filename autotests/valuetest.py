@@ -34,6 +34,28 @@ class SetValueCommand(ExtensionBase):
         return 'post', '/session/$sessionId/appium/element/$id/value'
 
 
+class GetPropertiesCommand(ExtensionBase):
+
+    def method_name(self):
+        return 'get_properties'
+
+    def get_properties(self, elements: list[WebElement], properties: list[str]):
+        """
+        Read properties of many elements in one request
+        Args:
+            elements: The elements to read from
+            properties: The property names
+        """
+        data = {
+            'elements': [element.id for element in elements],
+            'properties': properties,
+        }
+        return self.execute(data)['value']
+
+    def add_command(self):
+        return 'post', '/session/$sessionId/elements/properties'
+
+
 class ValueTest(unittest.TestCase):
 
     @classmethod
@@ -42,7 +64,7 @@ class ValueTest(unittest.TestCase):
         # The app capability may be a command line or a desktop file id.
         options.set_capability("app", f"{os.getenv('QML_EXEC')} {os.path.dirname(os.path.realpath(__file__))}/value.qml")
         # Boilerplate, always the same
-        self.driver = webdriver.Remote(command_executor='http://127.0.0.1:4723', extensions=[SetValueCommand], options=options)
+        self.driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", extensions=[SetValueCommand, GetPropertiesCommand], options=options)
         # Set a timeout for waiting to find elements. If elements cannot be found
         # in time we'll get a test failure. This should be somewhat long so as to
         # not fall over when the system is under load, but also not too long that
@@ -60,6 +82,18 @@ class ValueTest(unittest.TestCase):
         self.driver.set_value(slider, 100)
         self.assertEqual(float(slider.get_attribute('value')), 100.0)
 
+    def test_properties(self):
+        slider = self.driver.find_element(AppiumBy.NAME, "slider")
+        properties = self.driver.get_properties([slider], ['rect', 'name', 'enabled', 'displayed', 'value', 'focusable'])[slider.id]
+        self.assertEqual(properties['rect'], slider.rect)
+        self.assertEqual(properties['name'], "slider")
+        self.assertEqual(properties['enabled'], slider.is_enabled())
+        self.assertEqual(properties['displayed'], slider.is_displayed())
+        self.assertEqual(float(properties['value']), float(slider.get_attribute('value')))
+        self.assertEqual(properties['focusable'], slider.get_attribute('focusable'))
+
+        self.assertEqual(self.driver.get_properties([], ['rect']), {})
+
 
 if __name__ == '__main__':
     unittest.main()
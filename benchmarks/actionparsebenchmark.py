@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: AGPL-3.0-or-later
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Times how long selenium-webdriver-at-spi-inputsynth takes to read and set up long action sequences, as JSON and as
+# the CBOR the driver sends. Runs the helper with --parse-only, so no compositor is needed and nothing gets performed.
+#
+# Usage: actionparsebenchmark.py [steps] [iterations]
+# SELENIUM_INPUTSYNTH overrides the helper binary.
+
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+import cbor  # noqa: E402
+
+HELPER = os.getenv('SELENIUM_INPUTSYNTH', 'selenium-webdriver-at-spi-inputsynth')
+STEPS = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+ITERATIONS = int(sys.argv[2]) if len(sys.argv) > 2 else 5
+# Parse offscreen against a fixed layout, neither KWin nor the session bus are involved
+ENV = dict(os.environ, QT_QPA_PLATFORM='offscreen', KWIN_XKB_DEFAULT_KEYMAP='1', XKB_DEFAULT_LAYOUT='us')
+
+
+def gesture(steps):
+    # A recorded drag: press, a long trail of small moves, release
+    moves = [{'type': 'pointerMove', 'duration': 0, 'x': 100 + i % 800, 'y': 100 + i // 800, 'origin': 'viewport'}
+             for i in range(steps - 2)]
+    actions = [{'type': 'pointerDown', 'button': 0}] + moves + [{'type': 'pointerUp', 'button': 0}]
+    return {'actions': [{'type': 'pointer', 'id': 'finger', 'parameters': {'pointerType': 'touch'}, 'actions': actions}]}
+
+
+def typing(steps):
+    text = 'The quick brown fox jumps over the lazy dog. '
+    actions = []
+    for i in range(steps // 2):
+        actions.append({'type': 'keyDown', 'value': text[i % len(text)]})
+        actions.append({'type': 'keyUp', 'value': text[i % len(text)]})
+    return {'actions': [{'type': 'key', 'id': 'key', 'actions': actions}]}
+
+
+def parse(path):
+    out = subprocess.run([HELPER, '--parse-only', path], env=ENV, stdout=subprocess.PIPE, check=True).stdout.decode()
+    return int(re.search(r'in (\d+) us', out).group(1))
+
+
+def main():
+    with tempfile.TemporaryDirectory() as directory:
+        print(f'{STEPS} steps, median of {ITERATIONS}')
+        print(f'  {"sequence":<10} {"format":<6} {"size":>10} {"parse":>10}')
+        for name, sequence in [('gesture', gesture(STEPS)), ('typing', typing(STEPS))]:
+            for format_name, data in [('json', json.dumps(sequence).encode()), ('cbor', cbor.dumps(sequence))]:
+                path = os.path.join(directory, f'{name}.{format_name}')
+                with open(path, 'wb') as file:
+                    file.write(data)
+                parse(path)  # warm the keymap cache and the page cache
+                samples = sorted(parse(path) for _ in range(ITERATIONS))
+                print(f'  {name:<10} {format_name:<6} {len(data):>9}B {samples[len(samples) // 2] / 1000:>8.2f}ms')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: AGPL-3.0-or-later
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Compares the compare_images backends: the OpenCV path the driver used to take (import, PNG decode, matchTemplate)
+# against selenium-webdriver-at-spi-imagecompare with each instruction set the machine supports.
+#
+# Usage: imagecomparebenchmark.py [iterations]
+# SELENIUM_IMAGECOMPARE overrides the helper binary.
+#
+# For reference, the coarse-to-fine template search against the exhaustive one (AVX2, synthetic desktop, a template
+# with a bit of noise so there is no exact match to stop at; both found the same position and score):
+#   1920x1080,  64x64 template:  597 ms -> 19 ms
+#   1920x1080, 200x100 template: 4285 ms -> 23 ms
+#   3840x2160,  64x64 template: 1416 ms -> 55 ms
+#   3840x2160, 200x100 template: 7961 ms -> 85 ms
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import cv2 as cv
+import numpy as np
+
+HELPER = os.getenv('SELENIUM_IMAGECOMPARE', 'selenium-webdriver-at-spi-imagecompare')
+ITERATIONS = int(sys.argv[1]) if len(sys.argv) > 1 else 5
+SIZES = [(1920, 1080), (3840, 2160)]
+TEMPLATE_SIZE = 64
+
+
+def screen(width, height, seed):
+    # Something that compresses and matches like a desktop: flat panels with a bit of noise in them.
+    rng = np.random.default_rng(seed)
+    image = np.full((height, width, 3), 239, np.uint8)
+    for _ in range(200):
+        x, y = rng.integers(0, width - 1), rng.integers(0, height - 1)
+        w, h = rng.integers(8, 400), rng.integers(8, 200)
+        image[y:y + h, x:x + w] = rng.integers(0, 255, 3)
+    noise = rng.integers(0, 255, (height // 4, width // 4, 3), np.uint8)
+    image[:height // 4, :width // 4] = noise
+    return image
+
+
+def timed(function):
+    samples = []
+    for _ in range(ITERATIONS):
+        started = time.perf_counter()
+        function()
+        samples.append(time.perf_counter() - started)
+    return sorted(samples)[len(samples) // 2]
+
+
+def opencv(first, second):
+    with open(first, 'rb') as file:
+        image1 = cv.imdecode(np.frombuffer(file.read(), np.uint8), cv.IMREAD_COLOR)
+    with open(second, 'rb') as file:
+        image2 = cv.imdecode(np.frombuffer(file.read(), np.uint8), cv.IMREAD_COLOR)
+    return cv.minMaxLoc(cv.matchTemplate(image1, image2, cv.TM_SQDIFF_NORMED))
+
+
+def native(isa, mode, first, second, args=()):
+    env = dict(os.environ, SELENIUM_IMAGECOMPARE_ISA=isa)
+    return subprocess.run([HELPER, '--mode', mode, *args, first, second], env=env, stdout=subprocess.PIPE, check=True).stdout
+
+
+def supported_isas():
+    isas = []
+    for isa in ['scalar', 'sse2', 'avx2']:
+        env = dict(os.environ, SELENIUM_IMAGECOMPARE_ISA=isa)
+        with tempfile.NamedTemporaryFile(suffix='.png') as file:
+            cv.imwrite(file.name, np.zeros((1, 1, 3), np.uint8))
+            out = subprocess.run([HELPER, file.name, file.name], env=env, stdout=subprocess.PIPE, check=True).stdout
+        if f'"isa":"{isa}"' in out.decode():
+            isas.append(isa)
+    return isas
+
+
+def main():
+    started = time.perf_counter()
+    subprocess.run([sys.executable, '-c', 'import cv2'], check=True)
+    print(f'python + import cv2: {time.perf_counter() - started:.3f}s (paid once per driver, on first use)')
+
+    isas = supported_isas()
+    with tempfile.TemporaryDirectory() as directory:
+        for width, height in SIZES:
+            first = os.path.join(directory, f'{width}-first.png')
+            second = os.path.join(directory, f'{width}-second.png')
+            templ = os.path.join(directory, f'{width}-template.png')
+            image = screen(width, height, 1)
+            changed = image.copy()
+            changed[height // 2:height // 2 + 40, width // 2:width // 2 + 200] = 0
+            x, y = width * 2 // 3, height * 2 // 3
+            cv.imwrite(first, image)
+            cv.imwrite(second, changed)
+            cv.imwrite(templ, image[y:y + TEMPLATE_SIZE, x:x + TEMPLATE_SIZE])
+
+            print(f'\n{width}x{height}, {TEMPLATE_SIZE}x{TEMPLATE_SIZE} template, median of {ITERATIONS}')
+            # getChangedRegions against a baseline whose tile hashes are already cached
+            cache = os.path.join(directory, f'{width}.tilehashes')
+            native(isas[0], 'tiles', first, second, ['--baseline-cache', cache])
+
+            print(f'  {"backend":<10} {"getSimilarity":>14} {"matchTemplate":>14} {"(exhaustive)":>14} {"changedRegions":>15}')
+            print(f'  {"opencv":<10} {timed(lambda: opencv(first, second)):>13.3f}s '
+                  f'{timed(lambda: opencv(first, templ)):>13.3f}s {"-":>14} {"-":>15}')
+            for isa in isas:
+                similarity = timed(lambda: native(isa, 'similarity', first, second))
+                match = timed(lambda: native(isa, 'template', first, templ))
+                exhaustive = timed(lambda: native(isa, 'template', first, templ, ['--exhaustive']))
+                regions = timed(lambda: native(isa, 'tiles', first, second, ['--baseline-cache', cache]))
+                print(f'  {isa:<10} {similarity:>13.3f}s {match:>13.3f}s {exhaustive:>13.3f}s {regions:>14.3f}s')
+
+
+if __name__ == '__main__':
+    main()
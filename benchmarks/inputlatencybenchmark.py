@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: AGPL-3.0-or-later
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Measures how long an application takes from a key press to painting the typed character: the inputsynth injects the
+# key and the frame watcher waits for the first frame in which the text field changed. Needs a running driver, so start
+# it through the runner:
+#
+# Usage: selenium-webdriver-at-spi-run benchmarks/inputlatencybenchmark.py [repetitions]
+# LATENCY_APP overrides the application (a command line or desktop file id), LATENCY_ELEMENT the accessible name of the
+# text field to type into.
+
+import os
+import sys
+
+from appium import webdriver
+from appium.options.common.base import AppiumOptions
+from appium.webdriver.common.appiumby import AppiumBy
+
+REPETITIONS = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+APP = os.getenv('LATENCY_APP',
+                f"{os.getenv('QML_EXEC', 'qml')} {os.path.dirname(os.path.realpath(__file__))}/../autotests/textinput.qml")
+ELEMENT = os.getenv('LATENCY_ELEMENT', 'input')
+
+
+def main():
+    options = AppiumOptions()
+    options.set_capability('app', APP)
+    options.set_capability('timeouts', {'implicit': 10000})
+    driver = webdriver.Remote(command_executor=f"http://127.0.0.1:{os.getenv('FLASK_PORT', '4723')}", options=options)
+    try:
+        element = driver.find_element(AppiumBy.NAME, ELEMENT)
+        element.click()
+        key = {'type': 'key', 'id': 'key', 'actions': [{'type': 'keyDown', 'value': 'x'}, {'type': 'keyUp', 'value': 'x'}]}
+        result = driver.execute_script('mobile: measureInputLatency', {
+            'actions': [key],
+            'rect': element.rect,
+            'repetitions': REPETITIONS,
+        })
+    finally:
+        driver.quit()
+
+    print(f"{len(result['latencies'])} of {result['repetitions']} key presses painted, {result['timeouts']} timed out "
+          f"(frame times by {result['clock']})")
+    if result['latencies']:
+        print('  '.join(f'{name} {result[name]:.2f}ms' for name in ['min', 'median', 'p90', 'p99', 'max', 'mean']))
+
+
+if __name__ == '__main__':
+    main()
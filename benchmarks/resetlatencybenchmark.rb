@@ -0,0 +1,52 @@
+#!/usr/bin/env ruby
+# frozen_string_literal: true
+
+# SPDX-License-Identifier: AGPL-3.0-or-later
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Compares the per-test overhead of a warm pool against cold starting the whole stack for every test.
+# Runs a no-op test N times through `selenium-webdriver-at-spi-run --pool 1` and N times through a regular run,
+# then prints the reset latencies recorded by the pool next to the cold start wall times.
+#
+# Usage: resetlatencybenchmark.rb [iterations]
+# The environment is passed through, so e.g. TEST_WITH_KWIN_WAYLAND=0 benchmarks without nested KWin.
+
+require 'json'
+require 'tmpdir'
+
+RUNNER = ENV.fetch('SELENIUM_RUN', 'selenium-webdriver-at-spi-run')
+ITERATIONS = Integer(ARGV.fetch(0, '10'))
+NOOP = `which true`.strip
+
+def now
+  Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+def stats(label, values)
+  values = values.sort
+  mean = values.sum / values.size
+  puts format('%<label>-12s mean %<mean>8.3fs  median %<median>8.3fs  min %<min>8.3fs  max %<max>8.3fs  (n=%<n>d)',
+              label: label, mean: mean, median: values[values.size / 2], min: values.first, max: values.last,
+              n: values.size)
+end
+
+Dir.mktmpdir('selenium-reset-benchmark') do |dir|
+  env = { 'APPIUM_ARTIFACT_OUTPUT_PATH' => dir, 'TEST_WITH_VIDEO_RECORDER' => '0' }
+
+  started = now
+  system(env, RUNNER, '--pool', '1', *Array.new(ITERATIONS, NOOP), out: File::NULL, exception: true)
+  pool_total = now - started
+  results = JSON.parse(File.read(File.join(dir, 'appium_artifact_shards_results.json')))
+  resets = results.filter_map { |result| result['reset'] }
+
+  cold = Array.new(ITERATIONS) do
+    started = now
+    system(env, RUNNER, NOOP, out: File::NULL, exception: true)
+    now - started
+  end
+
+  stats('pool reset', resets)
+  stats('cold start', cold)
+  puts format('total        pool %<pool>.1fs  cold %<cold>.1fs  for %<n>d tests', pool: pool_total, cold: cold.sum,
+                                                                              n: ITERATIONS)
+end
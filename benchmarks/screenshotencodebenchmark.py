@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+
+# SPDX-License-Identifier: AGPL-3.0-or-later
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Compares the encodings of selenium-webdriver-at-spi-screenshotter by the time they take and the size they produce:
+# PNG at several levels on one thread and on all of them, QOI and raw. Runs the helper with --input, so it encodes an
+# image from disk instead of a screenshot and no compositor is needed.
+#
+# Usage: screenshotencodebenchmark.py [iterations] [image...]
+# Without images synthetic desktops in full HD and 4K are used. SELENIUM_SCREENSHOTTER overrides the helper binary.
+
+import base64
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+import cv2 as cv
+import numpy as np
+
+HELPER = os.getenv('SELENIUM_SCREENSHOTTER', 'selenium-webdriver-at-spi-screenshotter')
+ITERATIONS = int(sys.argv[1]) if len(sys.argv) > 1 else 5
+IMAGES = sys.argv[2:]
+SIZES = [(1920, 1080), (3840, 2160)]
+THREADS = os.cpu_count() or 1
+ENV = dict(os.environ, QT_QPA_PLATFORM='offscreen')
+CONFIGURATIONS = [
+    ('png', 6, 1),
+    ('png', 6, THREADS),
+    ('png', 1, 1),
+    ('png', 1, THREADS),
+    ('png', 0, THREADS),
+    ('qoi', 0, 1),
+    ('raw', 0, 1),
+]
+
+
+def screen(width, height, seed):
+    # Something that compresses like a desktop: flat panels, some text-like detail and a photo-like noisy corner.
+    rng = np.random.default_rng(seed)
+    image = np.full((height, width, 3), 239, np.uint8)
+    for _ in range(200):
+        x, y = rng.integers(0, width - 1), rng.integers(0, height - 1)
+        w, h = rng.integers(8, 400), rng.integers(8, 200)
+        image[y:y + h, x:x + w] = rng.integers(0, 255, 3)
+    for _ in range(2000):
+        x, y = rng.integers(0, width - 8), rng.integers(0, height - 12)
+        image[y:y + 12, x:x + 8] = np.where(rng.random((12, 8, 1)) < 0.3, 0, image[y:y + 12, x:x + 8])
+    noise = rng.integers(0, 255, (height // 4, width // 4, 3), np.uint8)
+    image[:height // 4, :width // 4] = noise
+    return image
+
+
+def encode(path, encoding, level, threads):
+    proc = subprocess.run([HELPER, '--input', path, '--encoding', encoding, '--level', str(level), '--threads', str(threads)],
+                          env=ENV, stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+    return int(re.search(r'encoded in (\d+) us', proc.stderr.decode()).group(1)), len(base64.b64decode(proc.stdout))
+
+
+def main():
+    with tempfile.TemporaryDirectory() as directory:
+        images = IMAGES
+        if not images:
+            for width, height in SIZES:
+                images.append(os.path.join(directory, f'{width}x{height}.png'))
+                cv.imwrite(images[-1], screen(width, height, 1))
+
+        for path in images:
+            print(f'\n{os.path.basename(path)}, median of {ITERATIONS}')
+            print(f'  {"encoding":<8} {"level":>5} {"threads":>7} {"encode":>10} {"size":>12}')
+            for encoding, level, threads in CONFIGURATIONS:
+                samples = sorted(encode(path, encoding, level, threads) for _ in range(ITERATIONS))
+                duration, size = samples[len(samples) // 2]
+                level_column = str(level) if encoding == 'png' else '-'
+                print(f'  {encoding:<8} {level_column:>5} {threads:>7} {duration / 1000:>8.2f}ms {size:>11}B')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "datacontrol.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include <QDebug>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+// Large enough to move data quickly, small enough that the size of the payload doesn't matter.
+constexpr size_t chunkSize = 64 * 1024;
+// How long pastes still running when the selection changes may take to finish.
+constexpr auto cancelGracePeriod = std::chrono::seconds(5);
+
+bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qWarning() << "failed to write" << strerror(errno);
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+} // namespace
+
+DataControlOffer::DataControlOffer(struct ::zwlr_data_control_offer_v1 *id)
+    : QtWayland::zwlr_data_control_offer_v1(id)
+{
+}
+
+DataControlOffer::~DataControlOffer()
+{
+    destroy();
+}
+
+QStringList DataControlOffer::mimeTypes() const
+{
+    return m_mimeTypes;
+}
+
+bool DataControlOffer::receiveTo(wl_display *display, const QString &mimeType, int outFd)
+{
+    auto pipeFds = std::to_array<int>({0, 0});
+    if (pipe2(pipeFds.data(), O_CLOEXEC) != 0) {
+        qWarning() << "failed to open pipe" << strerror(errno);
+        return false;
+    }
+    receive(mimeType, pipeFds.at(1));
+    ::close(pipeFds.at(1)); // the source client has its own copy now, EOF comes once it closes that
+    wl_display_flush(display);
+
+    std::array<char, chunkSize> buffer{};
+    bool ok = true;
+    while (true) {
+        const ssize_t bytes = ::read(pipeFds.at(0), buffer.data(), buffer.size());
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            qWarning() << "failed to read" << strerror(errno);
+            ok = false;
+            break;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        if (!writeAll(outFd, buffer.data(), bytes)) {
+            ok = false;
+            break;
+        }
+    }
+    ::close(pipeFds.at(0));
+    return ok;
+}
+
+void DataControlOffer::zwlr_data_control_offer_v1_offer(const QString &mime_type)
+{
+    m_mimeTypes << mime_type;
+}
+
+DataControlSource::DataControlSource(struct ::zwlr_data_control_source_v1 *id, const QStringList &mimeTypes, int dataFd)
+    : QtWayland::zwlr_data_control_source_v1(id)
+    , m_dataFd(dataFd)
+{
+    for (const auto &mimeType : mimeTypes) {
+        offer(mimeType);
+    }
+    m_cancelTimer.setSingleShot(true);
+    m_cancelTimer.setInterval(cancelGracePeriod);
+    connect(&m_cancelTimer, &QTimer::timeout, this, [this] {
+        m_cancelled = false;
+        Q_EMIT cancelled();
+    });
+}
+
+DataControlSource::~DataControlSource()
+{
+    for (const auto &transfer : m_transfers) {
+        transfer->notifier.reset();
+        ::close(transfer->fd);
+    }
+    destroy();
+}
+
+void DataControlSource::zwlr_data_control_source_v1_send(const QString &mime_type, int32_t fd)
+{
+    Q_UNUSED(mime_type);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    Transfer *transfer = m_transfers.emplace_back(std::make_unique<Transfer>(Transfer{.fd = fd})).get();
+    transfer->notifier = std::make_unique<QSocketNotifier>(fd, QSocketNotifier::Write);
+    connect(transfer->notifier.get(), &QSocketNotifier::activated, this, [this, transfer] {
+        write(transfer);
+    });
+}
+
+void DataControlSource::write(Transfer *transfer)
+{
+    std::array<char, chunkSize> buffer{};
+    while (true) {
+        const ssize_t bytes = ::pread(m_dataFd, buffer.data(), buffer.size(), transfer->offset);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            if (bytes < 0) {
+                qWarning() << "failed to read the spooled data" << strerror(errno);
+            }
+            finish(transfer);
+            return;
+        }
+        const ssize_t written = ::write(transfer->fd, buffer.data(), bytes);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                finish(transfer); // the reader went away
+            }
+            return; // until the pipe has room again
+        }
+        transfer->offset += written;
+    }
+}
+
+void DataControlSource::finish(Transfer *transfer)
+{
+    // We may well be in the notifier's signal right now
+    transfer->notifier->setEnabled(false);
+    transfer->notifier.release()->deleteLater();
+    ::close(transfer->fd);
+    std::erase_if(m_transfers, [transfer](const auto &candidate) {
+        return candidate.get() == transfer;
+    });
+    maybeCancelled();
+}
+
+void DataControlSource::maybeCancelled()
+{
+    if (m_cancelled && m_transfers.empty()) {
+        m_cancelled = false;
+        m_cancelTimer.stop();
+        Q_EMIT cancelled();
+    }
+}
+
+void DataControlSource::zwlr_data_control_source_v1_cancelled()
+{
+    // Pastes already running get a moment to finish, a reader that stopped reading doesn't keep us around.
+    m_cancelled = true;
+    m_cancelTimer.start();
+    maybeCancelled();
+}
+
+DataControlDevice::DataControlDevice(struct ::zwlr_data_control_device_v1 *id)
+    : QtWayland::zwlr_data_control_device_v1(id)
+{
+}
+
+DataControlDevice::~DataControlDevice()
+{
+    destroy();
+}
+
+DataControlOffer *DataControlDevice::selection(bool primary) const
+{
+    return primary ? m_primarySelection.get() : m_selection.get();
+}
+
+void DataControlDevice::setSelection(DataControlSource *source, bool primary)
+{
+    if (primary) {
+        set_primary_selection(source->object());
+    } else {
+        set_selection(source->object());
+    }
+}
+
+void DataControlDevice::zwlr_data_control_device_v1_data_offer(struct ::zwlr_data_control_offer_v1 *id)
+{
+    m_pendingOffers.push_back(std::make_unique<DataControlOffer>(id));
+}
+
+void DataControlDevice::zwlr_data_control_device_v1_selection(struct ::zwlr_data_control_offer_v1 *id)
+{
+    m_selection = takeOffer(id);
+}
+
+void DataControlDevice::zwlr_data_control_device_v1_primary_selection(struct ::zwlr_data_control_offer_v1 *id)
+{
+    m_primarySelection = takeOffer(id);
+}
+
+std::unique_ptr<DataControlOffer> DataControlDevice::takeOffer(struct ::zwlr_data_control_offer_v1 *id)
+{
+    if (!id) {
+        return nullptr;
+    }
+    for (auto it = m_pendingOffers.begin(); it != m_pendingOffers.end(); ++it) {
+        if ((*it)->object() == id) {
+            auto offer = std::move(*it);
+            m_pendingOffers.erase(it);
+            return offer;
+        }
+    }
+    qWarning() << "selection refers to an unknown offer";
+    return nullptr;
+}
+
+DataControlManager::DataControlManager()
+    : QWaylandClientExtensionTemplate<DataControlManager>(2)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    initialize();
+#else
+    // QWaylandClientExtensionTemplate invokes this with a QueuedConnection but we want it called immediately
+    QMetaObject::invokeMethod(this, "addRegistryListener", Qt::DirectConnection);
+#endif
+    if (!isInitialized()) {
+        qWarning() << "Remember requesting the interface on your desktop file: X-KDE-Wayland-Interfaces=zwlr_data_control_manager_v1";
+    }
+}
+
+DataControlManager::~DataControlManager()
+{
+    if (isInitialized()) {
+        destroy();
+    }
+}
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "qwayland-wlr-data-control-unstable-v1.h"
+#include <QObject>
+#include <QSocketNotifier>
+#include <QStringList>
+#include <QTimer>
+#include <QWaylandClientExtensionTemplate>
+
+#include <wayland-client-protocol.h>
+
+// Thin wrappers around the wlr data control protocol. It lets a privileged client read and set the selection without
+// having a focused surface, which is exactly what a test driver wants.
+
+class DataControlOffer : public QtWayland::zwlr_data_control_offer_v1
+{
+public:
+    explicit DataControlOffer(struct ::zwlr_data_control_offer_v1 *id);
+    ~DataControlOffer() override;
+    Q_DISABLE_COPY_MOVE(DataControlOffer)
+
+    [[nodiscard]] QStringList mimeTypes() const;
+
+    // Streams the data of mimeType into outFd. Blocks until the source client has written everything.
+    bool receiveTo(wl_display *display, const QString &mimeType, int outFd);
+
+protected:
+    void zwlr_data_control_offer_v1_offer(const QString &mime_type) override;
+
+private:
+    QStringList m_mimeTypes;
+};
+
+class DataControlSource : public QObject, public QtWayland::zwlr_data_control_source_v1
+{
+    Q_OBJECT
+public:
+    // Serves the content of dataFd (read with pread, so it can be shared by any number of transfers) for mimeTypes.
+    DataControlSource(struct ::zwlr_data_control_source_v1 *id, const QStringList &mimeTypes, int dataFd);
+    ~DataControlSource() override;
+    Q_DISABLE_COPY_MOVE(DataControlSource)
+
+Q_SIGNALS:
+    // Something else became the selection and the pastes still running are done, or given up on.
+    void cancelled();
+
+protected:
+    void zwlr_data_control_source_v1_send(const QString &mime_type, int32_t fd) override;
+    void zwlr_data_control_source_v1_cancelled() override;
+
+private:
+    // One paste. The receiving end may be slow or stop reading altogether, so we write whenever its pipe has room
+    // rather than block the event loop on it.
+    struct Transfer {
+        int fd;
+        off_t offset = 0;
+        std::unique_ptr<QSocketNotifier> notifier;
+    };
+
+    void write(Transfer *transfer);
+    void finish(Transfer *transfer);
+    void maybeCancelled();
+
+    int m_dataFd;
+    std::vector<std::unique_ptr<Transfer>> m_transfers;
+    bool m_cancelled = false;
+    QTimer m_cancelTimer;
+};
+
+class DataControlDevice : public QObject, public QtWayland::zwlr_data_control_device_v1
+{
+    Q_OBJECT
+public:
+    explicit DataControlDevice(struct ::zwlr_data_control_device_v1 *id);
+    ~DataControlDevice() override;
+    Q_DISABLE_COPY_MOVE(DataControlDevice)
+
+    // The current (primary) selection, nullptr when there is none.
+    [[nodiscard]] DataControlOffer *selection(bool primary) const;
+    void setSelection(DataControlSource *source, bool primary);
+
+protected:
+    void zwlr_data_control_device_v1_data_offer(struct ::zwlr_data_control_offer_v1 *id) override;
+    void zwlr_data_control_device_v1_selection(struct ::zwlr_data_control_offer_v1 *id) override;
+    void zwlr_data_control_device_v1_primary_selection(struct ::zwlr_data_control_offer_v1 *id) override;
+
+private:
+    std::unique_ptr<DataControlOffer> takeOffer(struct ::zwlr_data_control_offer_v1 *id);
+
+    std::vector<std::unique_ptr<DataControlOffer>> m_pendingOffers;
+    std::unique_ptr<DataControlOffer> m_selection;
+    std::unique_ptr<DataControlOffer> m_primarySelection;
+};
+
+class DataControlManager : public QWaylandClientExtensionTemplate<DataControlManager>, public QtWayland::zwlr_data_control_manager_v1
+{
+    Q_OBJECT
+public:
+    explicit DataControlManager();
+    ~DataControlManager() override;
+    Q_DISABLE_COPY_MOVE(DataControlManager)
+};
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QGuiApplication>
+#if QT_VERSION < QT_VERSION_CHECK(6, 5, 0)
+#include <qpa/qplatformnativeinterface.h>
+#endif
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "datacontrol.h"
+
+namespace
+{
+wl_display *display()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    return qGuiApp->nativeInterface<QNativeInterface::QWaylandApplication>()->display();
+#else
+    return static_cast<struct wl_display *>(qGuiApp->platformNativeInterface()->nativeResourceForIntegration("wl_display"));
+#endif
+}
+
+wl_seat *seat()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    return qGuiApp->nativeInterface<QNativeInterface::QWaylandApplication>()->seat();
+#else
+    return static_cast<struct wl_seat *>(qGuiApp->platformNativeInterface()->nativeResourceForIntegration("wl_seat"));
+#endif
+}
+
+// Picks the offered type to read: the first requested one on offer, or for plain text any of the spellings toolkits
+// use.
+QString pickMimeType(const QStringList &offered, const QStringList &requested)
+{
+    for (const auto &mimeType : requested) {
+        if (offered.contains(mimeType)) {
+            return mimeType;
+        }
+    }
+    const bool wantsText = std::ranges::any_of(requested, [](const QString &mimeType) {
+        return mimeType.startsWith(QLatin1String("text/plain"));
+    });
+    if (wantsText) {
+        for (const auto &candidate : {QStringLiteral("text/plain;charset=utf-8"), QStringLiteral("text/plain"), QStringLiteral("UTF8_STRING"), QStringLiteral("TEXT"), QStringLiteral("STRING")}) {
+            if (offered.contains(candidate)) {
+                return candidate;
+            }
+        }
+    }
+    return {};
+}
+
+// Spools stdin into an anonymous file so the data doesn't live in our heap and can be served to any number of
+// pastes. Returns -1 on failure.
+int spoolStdin()
+{
+    const int fd = memfd_create("selenium-clipboard", MFD_CLOEXEC);
+    if (fd < 0) {
+        qWarning() << "failed to create memfd" << strerror(errno);
+        return -1;
+    }
+    std::array<char, 64 * 1024> buffer{};
+    while (true) {
+        const ssize_t bytes = ::read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0) {
+            qWarning() << "failed to read stdin" << strerror(errno);
+            ::close(fd);
+            return -1;
+        }
+        if (bytes == 0) {
+            return fd;
+        }
+        for (ssize_t done = 0; done < bytes;) {
+            const ssize_t written = ::write(fd, buffer.data() + done, bytes - done);
+            if (written < 0 && errno != EINTR) {
+                qWarning() << "failed to spool stdin" << strerror(errno);
+                ::close(fd);
+                return -1;
+            }
+            done += std::max<ssize_t>(written, 0);
+        }
+    }
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // Readers that go away mid transfer must not take us down.
+    signal(SIGPIPE, SIG_IGN);
+
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Reads or sets the clipboard through the wlr data control protocol.\n"
+                                                    "list: prints the offered MIME types, one per line\n"
+                                                    "get: writes the content as the first offered --mime-type to stdout\n"
+                                                    "set: takes the content from stdin, prints 'ready' once it is the selection and serves it until "
+                                                    "something else becomes the selection"));
+    parser.addHelpOption();
+    const QCommandLineOption mimeTypeOption(QStringLiteral("mime-type"), QStringLiteral("MIME type to get, or to offer (repeatable)"), QStringLiteral("type"));
+    parser.addOption(mimeTypeOption);
+    const QCommandLineOption primaryOption(QStringLiteral("primary"), QStringLiteral("use the primary selection instead of the clipboard"));
+    parser.addOption(primaryOption);
+    parser.addPositionalArgument(QStringLiteral("command"), QStringLiteral("list, get or set"));
+    parser.process(app);
+
+    const auto arguments = parser.positionalArguments();
+    if (arguments.size() != 1) {
+        parser.showHelp(1);
+    }
+    const QString command = arguments.at(0);
+    const bool primary = parser.isSet(primaryOption);
+
+    DataControlManager manager;
+    if (!manager.isInitialized()) {
+        return 1;
+    }
+    auto device = std::make_unique<DataControlDevice>(manager.get_data_device(seat()));
+    // The current selection is announced right after binding the device
+    wl_display_roundtrip(display());
+
+    if (command == QLatin1String("list") || command == QLatin1String("get")) {
+        DataControlOffer *offer = device->selection(primary);
+        if (!offer) {
+            qWarning() << "nothing selected";
+            return 2;
+        }
+        if (command == QLatin1String("list")) {
+            for (const auto &mimeType : offer->mimeTypes()) {
+                printf("%s\n", qUtf8Printable(mimeType));
+            }
+            return 0;
+        }
+
+        QStringList requested = parser.values(mimeTypeOption);
+        if (requested.isEmpty()) {
+            requested << QStringLiteral("text/plain;charset=utf-8");
+        }
+        const QString mimeType = pickMimeType(offer->mimeTypes(), requested);
+        if (mimeType.isEmpty()) {
+            qWarning() << "selection doesn't offer" << requested << "only" << offer->mimeTypes();
+            return 2;
+        }
+        return offer->receiveTo(display(), mimeType, STDOUT_FILENO) ? 0 : 1;
+    }
+
+    if (command == QLatin1String("set")) {
+        const QStringList mimeTypes = parser.values(mimeTypeOption);
+        if (mimeTypes.isEmpty()) {
+            qWarning() << "set needs at least one --mime-type";
+            return 1;
+        }
+        const int dataFd = spoolStdin();
+        if (dataFd < 0) {
+            return 1;
+        }
+
+        DataControlSource source(manager.create_data_source(), mimeTypes, dataFd);
+        QObject::connect(&source, &DataControlSource::cancelled, &app, &QCoreApplication::quit);
+        device->setSelection(&source, primary);
+        wl_display_roundtrip(display());
+
+        // Whoever started us may stop waiting now. Detach from their pipe so they needn't drain it while we stay
+        // around serving the selection.
+        printf("ready\n");
+        fflush(stdout);
+        const int devNull = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        ::dup2(devNull, STDOUT_FILENO);
+        ::close(devNull);
+
+        const int ret = app.exec();
+        ::close(dataFd);
+        return ret;
+    }
+
+    parser.showHelp(1);
+}
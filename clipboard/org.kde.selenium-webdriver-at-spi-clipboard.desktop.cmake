@@ -0,0 +1,8 @@
+# SPDX-License-Identifier: CC0-1.0
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+[Desktop Entry]
+Name=Clipboard Authorize
+NoDisplay=true
+Exec=${CMAKE_INSTALL_PREFIX}/bin/selenium-webdriver-at-spi-clipboard
+Type=Application
+X-KDE-Wayland-Interfaces=zwlr_data_control_manager_v1
@@ -0,0 +1,331 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "comparison.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "kernels.h"
+
+namespace
+{
+
+constexpr size_t bytesPerPixel = 4;
+
+// Mirrors how OpenCV normalizes TM_SQDIFF_NORMED: anything that isn't below the norm is reported as 1. Unlike OpenCV
+// two identical all-black areas are a perfect match rather than a perfect mismatch.
+double normalize(uint64_t squaredDifference, double norm)
+{
+    if (squaredDifference == 0) {
+        return 0.0;
+    }
+    if (double(squaredDifference) < norm) {
+        return double(squaredDifference) / norm;
+    }
+    return 1.0;
+}
+
+uint64_t sumSquares(const Frame &frame)
+{
+    uint64_t sum = 0;
+    for (int y = 0; y < frame.height; ++y) {
+        sum += Kernels::sumSquares(frame.row(y), frame.width * bytesPerPixel);
+    }
+    return sum;
+}
+
+// Summed-area table of the per pixel sum of squares, (width + 1) * (height + 1) entries with a zero first row and
+// column. Gives the norm of any window in four lookups.
+std::vector<uint64_t> integralSquares(const Frame &frame)
+{
+    const size_t columns = frame.width + 1;
+    std::vector<uint64_t> integral(columns * (frame.height + 1), 0);
+    for (int y = 0; y < frame.height; ++y) {
+        const uint8_t *row = frame.row(y);
+        uint64_t rowSum = 0;
+        for (int x = 0; x < frame.width; ++x) {
+            const uint8_t *pixel = row + x * bytesPerPixel;
+            rowSum += pixel[0] * pixel[0] + pixel[1] * pixel[1] + pixel[2] * pixel[2] + pixel[3] * pixel[3];
+            integral[(y + 1) * columns + x + 1] = integral[y * columns + x + 1] + rowSum;
+        }
+    }
+    return integral;
+}
+
+} // namespace
+
+Difference difference(const Frame &first, const Frame &second)
+{
+    Difference result;
+    int left = first.width;
+    int right = -1;
+    int top = -1;
+    int bottom = -1;
+    for (int y = 0; y < first.height; ++y) {
+        const uint32_t *a = first.pixels(y);
+        const uint32_t *b = second.pixels(y);
+        const size_t pixels = Kernels::countDifferences(a, b, first.width);
+        if (pixels == 0) {
+            continue;
+        }
+        result.pixels += pixels;
+        if (top < 0) {
+            top = y;
+        }
+        bottom = y;
+        int x = 0;
+        while (a[x] == b[x]) {
+            ++x;
+        }
+        left = std::min(left, x);
+        x = first.width - 1;
+        while (a[x] == b[x]) {
+            --x;
+        }
+        right = std::max(right, x);
+    }
+    if (result.pixels > 0) {
+        result.bounds = {left, top, right - left + 1, bottom - top + 1};
+    }
+    return result;
+}
+
+double normalizedSquaredDifference(const Frame &first, const Frame &second)
+{
+    uint64_t squaredDifference = 0;
+    for (int y = 0; y < first.height; ++y) {
+        squaredDifference += Kernels::sumSquaredDifferences(first.row(y), second.row(y), first.width * bytesPerPixel);
+    }
+    return normalize(squaredDifference, std::sqrt(double(sumSquares(first)) * double(sumSquares(second))));
+}
+
+Match matchTemplate(const Frame &image, const Frame &templ, double threshold)
+{
+    Match best;
+    if (templ.width <= 0 || templ.height <= 0 || templ.width > image.width || templ.height > image.height) {
+        return best;
+    }
+
+    const size_t rowBytes = templ.width * bytesPerPixel;
+    const double templSquares = double(sumSquares(templ));
+    const std::vector<uint64_t> integral = integralSquares(image);
+    const size_t columns = image.width + 1;
+
+    for (int y = 0; y + templ.height <= image.height; ++y) {
+        for (int x = 0; x + templ.width <= image.width; ++x) {
+            const uint64_t windowSquares = integral[(y + templ.height) * columns + x + templ.width] - integral[y * columns + x + templ.width]
+                - integral[(y + templ.height) * columns + x] + integral[y * columns + x];
+            const double norm = std::sqrt(templSquares * double(windowSquares));
+
+            // The largest squared difference that could still beat what we have. Scores at or above 1 all clamp to
+            // 1, so there is nothing to bound in that case.
+            const double bound = best.found ? best.score : threshold;
+            const double limit = (bound >= 1.0 || norm == 0.0) ? std::numeric_limits<double>::infinity() : bound * norm;
+
+            uint64_t squaredDifference = 0;
+            const uint8_t *window = image.row(y) + x * bytesPerPixel;
+            for (int row = 0; row < templ.height && double(squaredDifference) <= limit; ++row) {
+                squaredDifference += Kernels::sumSquaredDifferences(window + row * image.stride, templ.row(row), rowBytes);
+            }
+            if (double(squaredDifference) > limit) {
+                continue;
+            }
+
+            const double score = normalize(squaredDifference, norm);
+            if (score <= threshold && (!best.found || score < best.score)) {
+                best = {true, x, y, score};
+                if (score == 0.0) {
+                    return best; // Can't get any better, and the first perfect match is also what OpenCV reports.
+                }
+            }
+        }
+    }
+    return best;
+}
+
+namespace
+{
+
+constexpr int maximumPyramidLevels = 4;
+constexpr int minimumPyramidTemplateSize = 8; // smaller edge of the template on the coarsest level
+constexpr size_t pyramidCandidates = 8;
+constexpr int refineRadius = 2; // covers the rounding of halving plus one pixel of coarse level imprecision
+
+// A downscaled copy of a frame.
+struct ScaledFrame {
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> pixels;
+
+    [[nodiscard]] Frame frame() const
+    {
+        return {width, height, ptrdiff_t(width * bytesPerPixel), reinterpret_cast<const uint8_t *>(pixels.data())};
+    }
+};
+
+// Halves both dimensions by averaging 2x2 blocks channel by channel.
+ScaledFrame halve(const Frame &frame)
+{
+    ScaledFrame scaled{frame.width / 2, frame.height / 2, {}};
+    scaled.pixels.resize(size_t(scaled.width) * scaled.height);
+    for (int y = 0; y < scaled.height; ++y) {
+        const uint32_t *top = frame.pixels(2 * y);
+        const uint32_t *bottom = frame.pixels(2 * y + 1);
+        uint32_t *out = scaled.pixels.data() + size_t(y) * scaled.width;
+        for (int x = 0; x < scaled.width; ++x) {
+            uint32_t pixel = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                const uint32_t sum = ((top[2 * x] >> shift) & 0xff) + ((top[2 * x + 1] >> shift) & 0xff) + ((bottom[2 * x] >> shift) & 0xff)
+                    + ((bottom[2 * x + 1] >> shift) & 0xff);
+                pixel |= ((sum + 2) / 4) << shift;
+            }
+            out[x] = pixel;
+        }
+    }
+    return scaled;
+}
+
+// TM_SQDIFF_NORMED of templ at (x, y), or infinity once it's clear the score would be above bound.
+double scoreAt(const Frame &image, const Frame &templ, double templSquares, int x, int y, double bound)
+{
+    const size_t rowBytes = templ.width * bytesPerPixel;
+    const uint8_t *window = image.row(y) + x * bytesPerPixel;
+    uint64_t windowSquares = 0;
+    for (int row = 0; row < templ.height; ++row) {
+        windowSquares += Kernels::sumSquares(window + row * image.stride, rowBytes);
+    }
+    const double norm = std::sqrt(templSquares * double(windowSquares));
+    const double limit = (bound >= 1.0 || norm == 0.0) ? std::numeric_limits<double>::infinity() : bound * norm;
+
+    uint64_t squaredDifference = 0;
+    for (int row = 0; row < templ.height && double(squaredDifference) <= limit; ++row) {
+        squaredDifference += Kernels::sumSquaredDifferences(window + row * image.stride, templ.row(row), rowBytes);
+    }
+    if (double(squaredDifference) > limit) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return normalize(squaredDifference, norm);
+}
+
+// Looks for a better match than best in the window of refineRadius around (centerX, centerY).
+void refine(const Frame &image, const Frame &templ, double templSquares, int centerX, int centerY, Match &best)
+{
+    const int top = std::max(0, centerY - refineRadius);
+    const int bottom = std::min(image.height - templ.height, centerY + refineRadius);
+    const int left = std::max(0, centerX - refineRadius);
+    const int right = std::min(image.width - templ.width, centerX + refineRadius);
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
+            const double score = scoreAt(image, templ, templSquares, x, y, best.score);
+            if (score < best.score) {
+                best = {true, x, y, score};
+            }
+        }
+    }
+}
+
+// The best scoring positions on a (coarse) level, at least half a template apart from each other so the candidates
+// aren't all the same spot shifted by a pixel.
+std::vector<std::pair<int, int>> candidates(const Frame &image, const Frame &templ, size_t count)
+{
+    struct Position {
+        double score;
+        int x;
+        int y;
+    };
+    std::vector<Position> positions;
+    positions.reserve(size_t(image.width - templ.width + 1) * (image.height - templ.height + 1));
+    const double templSquares = double(sumSquares(templ));
+    for (int y = 0; y + templ.height <= image.height; ++y) {
+        for (int x = 0; x + templ.width <= image.width; ++x) {
+            positions.push_back({scoreAt(image, templ, templSquares, x, y, std::numeric_limits<double>::infinity()), x, y});
+        }
+    }
+    std::sort(positions.begin(), positions.end(), [](const Position &a, const Position &b) {
+        return a.score < b.score || (a.score == b.score && (a.y < b.y || (a.y == b.y && a.x < b.x)));
+    });
+
+    std::vector<std::pair<int, int>> picked;
+    for (const auto &position : positions) {
+        const bool separate = std::all_of(picked.begin(), picked.end(), [&](const auto &other) {
+            return std::abs(other.first - position.x) > templ.width / 2 || std::abs(other.second - position.y) > templ.height / 2;
+        });
+        if (separate) {
+            picked.emplace_back(position.x, position.y);
+            if (picked.size() == count) {
+                break;
+            }
+        }
+    }
+    return picked;
+}
+
+} // namespace
+
+int pyramidLevels(const Frame &templ)
+{
+    int levels = 0;
+    while (levels < maximumPyramidLevels && (std::min(templ.width, templ.height) >> (levels + 1)) >= minimumPyramidTemplateSize) {
+        ++levels;
+    }
+    return levels;
+}
+
+Match matchTemplatePyramid(const Frame &image, const Frame &templ, double threshold)
+{
+    const int levels = pyramidLevels(templ);
+    if (levels == 0 || templ.width > image.width || templ.height > image.height) {
+        return matchTemplate(image, templ, threshold);
+    }
+
+    // Level 0 is the input itself, level n is scaled down by 2^n.
+    std::vector<ScaledFrame> scaledImages;
+    std::vector<ScaledFrame> scaledTempls;
+    for (int level = 1; level <= levels; ++level) {
+        scaledImages.push_back(halve(level == 1 ? image : scaledImages.back().frame()));
+        scaledTempls.push_back(halve(level == 1 ? templ : scaledTempls.back().frame()));
+    }
+    const auto imageAt = [&](int level) {
+        return level == 0 ? image : scaledImages[level - 1].frame();
+    };
+    const auto templAt = [&](int level) {
+        return level == 0 ? templ : scaledTempls[level - 1].frame();
+    };
+
+    std::vector<std::pair<int, int>> positions = candidates(imageAt(levels), templAt(levels), pyramidCandidates);
+    for (int level = levels - 1; level > 0; --level) {
+        const Frame levelImage = imageAt(level);
+        const Frame levelTempl = templAt(level);
+        const double templSquares = double(sumSquares(levelTempl));
+        for (auto &[x, y] : positions) {
+            Match best;
+            refine(levelImage, levelTempl, templSquares, 2 * x, 2 * y, best);
+            x = best.x;
+            y = best.y;
+        }
+    }
+
+    // On full resolution all candidates compete, which also lets them prune each other.
+    Match best;
+    const double templSquares = double(sumSquares(templ));
+    for (const auto &[x, y] : positions) {
+        refine(image, templ, templSquares, 2 * x, 2 * y, best);
+    }
+    if (!best.found || best.score > threshold) {
+        return {};
+    }
+    return best;
+}
+
+Frame crop(const Frame &frame, const Rect &rect)
+{
+    const int left = std::clamp(rect.x, 0, frame.width);
+    const int top = std::clamp(rect.y, 0, frame.height);
+    const int right = std::clamp(rect.x + rect.width, left, frame.width);
+    const int bottom = std::clamp(rect.y + rect.height, top, frame.height);
+    return {right - left, bottom - top, frame.stride, frame.row(top) + left * bytesPerPixel};
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// A view on a 32 bit per pixel frame, e.g. a QImage::Format_RGB32 screenshot. The byte that isn't a color channel
+// must be the same in all frames (the loader zeroes it) so the kernels can run over whole rows without masking.
+struct Frame {
+    int width = 0;
+    int height = 0;
+    ptrdiff_t stride = 0; // in bytes
+    const uint8_t *bits = nullptr;
+
+    [[nodiscard]] const uint8_t *row(int y) const
+    {
+        return bits + y * stride;
+    }
+    [[nodiscard]] const uint32_t *pixels(int y) const
+    {
+        return reinterpret_cast<const uint32_t *>(row(y));
+    }
+};
+
+struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+struct Difference {
+    size_t pixels = 0; // number of pixels that differ
+    Rect bounds; // bounding rectangle of all differing pixels
+};
+
+// Exact pixel difference of two frames of the same size.
+Difference difference(const Frame &first, const Frame &second);
+
+// Normalized squared difference of two frames of the same size, the same as OpenCV's TM_SQDIFF_NORMED: 0 means
+// identical, 1 means as different as can be.
+double normalizedSquaredDifference(const Frame &first, const Frame &second);
+
+struct Match {
+    bool found = false;
+    int x = 0;
+    int y = 0;
+    double score = std::numeric_limits<double>::infinity(); // TM_SQDIFF_NORMED at (x, y)
+};
+
+// Finds the position of templ in image with the lowest normalized squared difference. Only positions scoring at most
+// threshold are considered, which lets the search abandon a position as soon as its partial difference is too large;
+// for the common exact-ish search most positions are rejected after the first template row.
+Match matchTemplate(const Frame &image, const Frame &templ, double threshold = std::numeric_limits<double>::infinity());
+
+// Number of 2x downscaled levels matchTemplatePyramid() would search templ on. 0 when templ is too small to be
+// downscaled meaningfully, in which case the pyramid search is the exhaustive one.
+int pyramidLevels(const Frame &templ);
+
+// Coarse-to-fine variant of matchTemplate(): searches exhaustively only on the smallest level of an image pyramid,
+// then refines the best few candidates level by level in a small window around them. The reported score is exact at
+// full resolution; the position is the exhaustive result unless the true best match doesn't stand out at all on the
+// coarse level, e.g. a template that is mostly a flat color.
+Match matchTemplatePyramid(const Frame &image, const Frame &templ, double threshold = std::numeric_limits<double>::infinity());
+
+// The part of frame covered by rect, clipped to the frame. Positions found in the result are relative to rect.
+Frame crop(const Frame &frame, const Rect &rect);
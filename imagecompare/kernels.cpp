@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGECOMPARE_X86
+#include <immintrin.h>
+#endif
+
+namespace Kernels
+{
+
+namespace
+{
+
+struct Table {
+    Isa isa;
+    uint64_t (*sumSquaredDifferences)(const uint8_t *a, const uint8_t *b, size_t length);
+    uint64_t (*sumSquares)(const uint8_t *data, size_t length);
+    size_t (*countDifferences)(const uint32_t *a, const uint32_t *b, size_t count);
+};
+
+uint64_t sumSquaredDifferencesScalar(const uint8_t *a, const uint8_t *b, size_t length)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const int difference = int(a[i]) - int(b[i]);
+        sum += uint64_t(difference * difference);
+    }
+    return sum;
+}
+
+uint64_t sumSquaresScalar(const uint8_t *data, size_t length)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < length; ++i) {
+        sum += uint64_t(data[i]) * data[i];
+    }
+    return sum;
+}
+
+size_t countDifferencesScalar(const uint32_t *a, const uint32_t *b, size_t count)
+{
+    size_t differences = 0;
+    for (size_t i = 0; i < count; ++i) {
+        differences += a[i] != b[i];
+    }
+    return differences;
+}
+
+#ifdef IMAGECOMPARE_X86
+
+// The vector kernels accumulate squares in 32 bit lanes. Every iteration adds at most 2 * 2 * 255^2 to a lane, so
+// after this many iterations the lanes are folded into the 64 bit total before they could overflow.
+constexpr size_t chunkIterations = 8192;
+
+__attribute__((target("sse2"))) uint64_t horizontalSum(__m128i lanes)
+{
+    std::array<uint32_t, 4> values{};
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(values.data()), lanes);
+    uint64_t sum = 0;
+    for (const auto value : values) {
+        sum += value;
+    }
+    return sum;
+}
+
+__attribute__((target("sse2"))) uint64_t sumSquaredDifferencesSSE2(const uint8_t *a, const uint8_t *b, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorLength = length & ~size_t(15);
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i < vectorLength) {
+        const size_t chunkEnd = std::min(vectorLength, i + chunkIterations * 16);
+        __m128i accumulator = zero;
+        for (; i < chunkEnd; i += 16) {
+            const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+            const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+            const __m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            const __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(low, low));
+            accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(high, high));
+        }
+        sum += horizontalSum(accumulator);
+    }
+    return sum + sumSquaredDifferencesScalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("sse2"))) uint64_t sumSquaresSSE2(const uint8_t *data, size_t length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const size_t vectorLength = length & ~size_t(15);
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i < vectorLength) {
+        const size_t chunkEnd = std::min(vectorLength, i + chunkIterations * 16);
+        __m128i accumulator = zero;
+        for (; i < chunkEnd; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            const __m128i low = _mm_unpacklo_epi8(v, zero);
+            const __m128i high = _mm_unpackhi_epi8(v, zero);
+            accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(low, low));
+            accumulator = _mm_add_epi32(accumulator, _mm_madd_epi16(high, high));
+        }
+        sum += horizontalSum(accumulator);
+    }
+    return sum + sumSquaresScalar(data + i, length - i);
+}
+
+__attribute__((target("sse2,popcnt"))) size_t countDifferencesSSE2(const uint32_t *a, const uint32_t *b, size_t count)
+{
+    const size_t vectorCount = count & ~size_t(3);
+    size_t differences = 0;
+    for (size_t i = 0; i < vectorCount; i += 4) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        const int equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+        differences += 4 - __builtin_popcount(equal);
+    }
+    return differences + countDifferencesScalar(a + vectorCount, b + vectorCount, count - vectorCount);
+}
+
+__attribute__((target("avx2"))) uint64_t horizontalSum(__m256i lanes)
+{
+    std::array<uint32_t, 8> values{};
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(values.data()), lanes);
+    uint64_t sum = 0;
+    for (const auto value : values) {
+        sum += value;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2"))) uint64_t sumSquaredDifferencesAVX2(const uint8_t *a, const uint8_t *b, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorLength = length & ~size_t(31);
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i < vectorLength) {
+        const size_t chunkEnd = std::min(vectorLength, i + chunkIterations * 32);
+        __m256i accumulator = zero;
+        for (; i < chunkEnd; i += 32) {
+            const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+            // Unpacking works per 128 bit lane, which shuffles the bytes around but a sum doesn't care.
+            const __m256i low = _mm256_sub_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+            const __m256i high = _mm256_sub_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+            accumulator = _mm256_add_epi32(accumulator, _mm256_madd_epi16(low, low));
+            accumulator = _mm256_add_epi32(accumulator, _mm256_madd_epi16(high, high));
+        }
+        sum += horizontalSum(accumulator);
+    }
+    return sum + sumSquaredDifferencesScalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2"))) uint64_t sumSquaresAVX2(const uint8_t *data, size_t length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const size_t vectorLength = length & ~size_t(31);
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i < vectorLength) {
+        const size_t chunkEnd = std::min(vectorLength, i + chunkIterations * 32);
+        __m256i accumulator = zero;
+        for (; i < chunkEnd; i += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            const __m256i low = _mm256_unpacklo_epi8(v, zero);
+            const __m256i high = _mm256_unpackhi_epi8(v, zero);
+            accumulator = _mm256_add_epi32(accumulator, _mm256_madd_epi16(low, low));
+            accumulator = _mm256_add_epi32(accumulator, _mm256_madd_epi16(high, high));
+        }
+        sum += horizontalSum(accumulator);
+    }
+    return sum + sumSquaresScalar(data + i, length - i);
+}
+
+__attribute__((target("avx2,popcnt"))) size_t countDifferencesAVX2(const uint32_t *a, const uint32_t *b, size_t count)
+{
+    const size_t vectorCount = count & ~size_t(7);
+    size_t differences = 0;
+    for (size_t i = 0; i < vectorCount; i += 8) {
+        const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        const int equal = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb)));
+        differences += 8 - __builtin_popcount(equal);
+    }
+    return differences + countDifferencesScalar(a + vectorCount, b + vectorCount, count - vectorCount);
+}
+
+#endif // IMAGECOMPARE_X86
+
+bool supported(Isa isa)
+{
+    switch (isa) {
+    case Isa::Scalar:
+        return true;
+#ifdef IMAGECOMPARE_X86
+    case Isa::SSE2:
+        return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt");
+    case Isa::AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+    case Isa::SSE2:
+    case Isa::AVX2:
+        return false;
+#endif
+    }
+    return false;
+}
+
+Table makeTable(Isa isa)
+{
+    switch (isa) {
+#ifdef IMAGECOMPARE_X86
+    case Isa::AVX2:
+        return {Isa::AVX2, sumSquaredDifferencesAVX2, sumSquaresAVX2, countDifferencesAVX2};
+    case Isa::SSE2:
+        return {Isa::SSE2, sumSquaredDifferencesSSE2, sumSquaresSSE2, countDifferencesSSE2};
+#endif
+    default:
+        return {Isa::Scalar, sumSquaredDifferencesScalar, sumSquaresScalar, countDifferencesScalar};
+    }
+}
+
+Table selectTable()
+{
+    std::array<Isa, 3> candidates{Isa::AVX2, Isa::SSE2, Isa::Scalar};
+    if (const char *forced = std::getenv("SELENIUM_IMAGECOMPARE_ISA")) {
+        for (const auto candidate : candidates) {
+            if (std::strcmp(forced, isaName(candidate)) == 0 && supported(candidate)) {
+                return makeTable(candidate);
+            }
+        }
+    }
+    for (const auto candidate : candidates) {
+        if (supported(candidate)) {
+            return makeTable(candidate);
+        }
+    }
+    return makeTable(Isa::Scalar);
+}
+
+const Table &table()
+{
+    static const Table table = selectTable();
+    return table;
+}
+
+} // namespace
+
+Isa isa()
+{
+    return table().isa;
+}
+
+const char *isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::SSE2:
+        return "sse2";
+    case Isa::AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+uint64_t sumSquaredDifferences(const uint8_t *a, const uint8_t *b, size_t length)
+{
+    return table().sumSquaredDifferences(a, b, length);
+}
+
+uint64_t sumSquares(const uint8_t *data, size_t length)
+{
+    return table().sumSquares(data, length);
+}
+
+size_t countDifferences(const uint32_t *a, const uint32_t *b, size_t count)
+{
+    return table().countDifferences(a, b, count);
+}
+
+} // namespace Kernels
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Byte and pixel kernels the comparisons are built from. Every kernel exists as a scalar, an SSE2 and an AVX2
+// variant; the best one the CPU supports is picked on first use. SELENIUM_IMAGECOMPARE_ISA=scalar|sse2|avx2 forces
+// a (supported) variant, which is mostly useful for benchmarking and for checking the variants against each other.
+namespace Kernels
+{
+
+enum class Isa {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+Isa isa();
+const char *isaName(Isa isa);
+
+// Sum of (a[i] - b[i])^2 over length bytes.
+uint64_t sumSquaredDifferences(const uint8_t *a, const uint8_t *b, size_t length);
+
+// Sum of data[i]^2 over length bytes.
+uint64_t sumSquares(const uint8_t *data, size_t length);
+
+// Number of 32 bit pixels that are not bitwise identical.
+size_t countDifferences(const uint32_t *a, const uint32_t *b, size_t count);
+
+} // namespace Kernels
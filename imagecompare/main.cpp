@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <algorithm>
+#include <optional>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSize>
+
+#include "comparison.h"
+#include "kernels.h"
+#include "tilehash.h"
+
+namespace
+{
+std::optional<QSize> parseSize(const QString &string)
+{
+    static const QRegularExpression expression(QStringLiteral("^(\\d+)x(\\d+)$"));
+    const auto match = expression.match(string);
+    if (!match.hasMatch()) {
+        return std::nullopt;
+    }
+    return QSize(match.captured(1).toInt(), match.captured(2).toInt());
+}
+
+std::optional<Rect> parseRect(const QString &string)
+{
+    static const QRegularExpression expression(QStringLiteral("^(-?\\d+),(-?\\d+),(\\d+),(\\d+)$"));
+    const auto match = expression.match(string);
+    if (!match.hasMatch()) {
+        return std::nullopt;
+    }
+    return Rect{match.captured(1).toInt(), match.captured(2).toInt(), match.captured(3).toInt(), match.captured(4).toInt()};
+}
+
+// Loads an image file (anything QImage can read, notably PNG) or, when a size is given, a raw frame of 32 bit pixels
+// as produced by KWin's ScreenShot2 interface. The returned image is ARGB32 with the alpha byte zeroed, so frames from
+// either source compare byte for byte.
+QImage loadImage(const QString &path, const QString &size)
+{
+    QImage image;
+    if (size.isEmpty()) {
+        if (!image.load(path)) {
+            qWarning() << "failed to load image" << path;
+            return {};
+        }
+        image = image.convertToFormat(QImage::Format_ARGB32);
+    } else {
+        const auto dimensions = parseSize(size);
+        if (!dimensions.has_value()) {
+            qWarning() << "invalid frame size" << size;
+            return {};
+        }
+        QFile file(path);
+        if (!file.open(QFile::ReadOnly)) {
+            qWarning() << "failed to open frame" << path;
+            return {};
+        }
+        image = QImage(dimensions.value(), QImage::Format_ARGB32);
+        const auto bytes = image.sizeInBytes();
+        if (file.read(reinterpret_cast<char *>(image.bits()), bytes) != bytes) {
+            qWarning() << "frame is smaller than" << size << path;
+            return {};
+        }
+    }
+
+    // Like OpenCV's IMREAD_COLOR we only look at the color channels.
+    for (int y = 0; y < image.height(); ++y) {
+        auto *pixels = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            pixels[x] &= RGB_MASK;
+        }
+    }
+    return image;
+}
+
+Frame toFrame(const QImage &image)
+{
+    return {image.width(), image.height(), image.bytesPerLine(), image.constBits()};
+}
+
+QJsonObject toJson(const Rect &rect)
+{
+    return {{QStringLiteral("x"), rect.x}, {QStringLiteral("y"), rect.y}, {QStringLiteral("width"), rect.width}, {QStringLiteral("height"), rect.height}};
+}
+
+constexpr quint32 tileHashesMagic = 0x53544831; // STH1
+
+std::optional<TileHashes> loadTileHashes(const QString &path, int tileSize)
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        return std::nullopt;
+    }
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    TileHashes hashes;
+    stream >> magic >> hashes.width >> hashes.height >> hashes.tileSize >> hashes.columns >> hashes.rows;
+    if (magic != tileHashesMagic || hashes.tileSize != tileSize || hashes.columns <= 0 || hashes.rows <= 0) {
+        return std::nullopt;
+    }
+    hashes.tiles.resize(size_t(hashes.columns) * hashes.rows);
+    for (auto &tile : hashes.tiles) {
+        quint64 exact = 0;
+        quint64 perceptual = 0;
+        quint8 mean = 0;
+        stream >> exact >> perceptual >> mean;
+        tile = {exact, perceptual, mean};
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qWarning() << "ignoring corrupt tile hash cache" << path;
+        return std::nullopt;
+    }
+    return hashes;
+}
+
+void saveTileHashes(const QString &path, const TileHashes &hashes)
+{
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "failed to write tile hash cache" << path << file.errorString();
+        return;
+    }
+    QDataStream stream(&file);
+    stream << tileHashesMagic << hashes.width << hashes.height << hashes.tileSize << hashes.columns << hashes.rows;
+    for (const auto &tile : hashes.tiles) {
+        stream << quint64(tile.exact) << quint64(tile.perceptual) << quint8(tile.mean);
+    }
+    file.commit();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Compares two images. Prints the result as JSON."));
+    parser.addHelpOption();
+    const QCommandLineOption modeOption(QStringLiteral("mode"), QStringLiteral("similarity (TM_SQDIFF_NORMED of same sized images), template (find second in first), diff (exact pixel difference) or tiles (changed tiles of second compared to first)"), QStringLiteral("mode"), QStringLiteral("similarity"));
+    parser.addOption(modeOption);
+    const QCommandLineOption thresholdOption(QStringLiteral("threshold"), QStringLiteral("template: only accept matches scoring at most this"), QStringLiteral("score"));
+    parser.addOption(thresholdOption);
+    const QCommandLineOption roiOption(QStringLiteral("roi"), QStringLiteral("template: only search this region of first"), QStringLiteral("x,y,width,height"));
+    parser.addOption(roiOption);
+    const QCommandLineOption exhaustiveOption(QStringLiteral("exhaustive"), QStringLiteral("template: search every position on full resolution instead of coarse-to-fine"));
+    parser.addOption(exhaustiveOption);
+    const QCommandLineOption firstSizeOption(QStringLiteral("first-size"), QStringLiteral("first is a raw 32 bit frame of this size"), QStringLiteral("WIDTHxHEIGHT"));
+    parser.addOption(firstSizeOption);
+    const QCommandLineOption secondSizeOption(QStringLiteral("second-size"), QStringLiteral("second is a raw 32 bit frame of this size"), QStringLiteral("WIDTHxHEIGHT"));
+    parser.addOption(secondSizeOption);
+    const QCommandLineOption tileSizeOption(QStringLiteral("tile-size"), QStringLiteral("tiles: edge length of the tiles"), QStringLiteral("pixels"), QStringLiteral("32"));
+    parser.addOption(tileSizeOption);
+    const QCommandLineOption toleranceOption(QStringLiteral("tolerance"), QStringLiteral("tiles: perceptual hash bits and luminance levels a tile may differ by"), QStringLiteral("count"), QStringLiteral("0"));
+    parser.addOption(toleranceOption);
+    const QCommandLineOption firstOnlyOption(QStringLiteral("first-only"), QStringLiteral("tiles: stop at the first changed tile"));
+    parser.addOption(firstOnlyOption);
+    const QCommandLineOption baselineCacheOption(QStringLiteral("baseline-cache"), QStringLiteral("tiles: file caching the tile hashes of first"), QStringLiteral("file"));
+    parser.addOption(baselineCacheOption);
+    parser.addPositionalArgument(QStringLiteral("first"), QStringLiteral("image or frame file"));
+    parser.addPositionalArgument(QStringLiteral("second"), QStringLiteral("image or frame file"));
+    parser.process(app);
+
+    const auto arguments = parser.positionalArguments();
+    if (arguments.size() != 2) {
+        parser.showHelp(1);
+    }
+
+    QJsonObject result{{QStringLiteral("isa"), QString::fromLatin1(Kernels::isaName(Kernels::isa()))}};
+    const QString mode = parser.value(modeOption);
+
+    if (mode == QLatin1String("tiles")) {
+        // Handled up front because with a cached baseline the first image needn't be loaded at all.
+        const int tileSize = parser.value(tileSizeOption).toInt();
+        const int tolerance = parser.value(toleranceOption).toInt();
+        if (tileSize <= 0) {
+            qWarning() << "invalid tile size" << parser.value(tileSizeOption);
+            return 1;
+        }
+
+        const QString cachePath = parser.value(baselineCacheOption);
+        std::optional<TileHashes> baseline;
+        if (!cachePath.isEmpty()) {
+            baseline = loadTileHashes(cachePath, tileSize);
+        }
+        result.insert(QStringLiteral("cached"), baseline.has_value());
+        if (!baseline.has_value()) {
+            const QImage first = loadImage(arguments.at(0), parser.value(firstSizeOption));
+            if (first.isNull()) {
+                return 1;
+            }
+            baseline = hashTiles(toFrame(first), tileSize);
+            if (!cachePath.isEmpty()) {
+                saveTileHashes(cachePath, baseline.value());
+            }
+        }
+
+        const QImage second = loadImage(arguments.at(1), parser.value(secondSizeOption));
+        if (second.isNull()) {
+            return 1;
+        }
+        const TileDifference difference = tileDifference(baseline.value(), toFrame(second), tolerance, parser.isSet(firstOnlyOption));
+        QJsonArray rects;
+        for (const auto &rect : difference.rects) {
+            rects.append(toJson(rect));
+        }
+        result.insert(QStringLiteral("changed"), difference.tiles > 0);
+        result.insert(QStringLiteral("tiles"), qint64(difference.tiles));
+        result.insert(QStringLiteral("rects"), rects);
+        printf("%s", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+        return 0;
+    }
+
+    const QImage first = loadImage(arguments.at(0), parser.value(firstSizeOption));
+    const QImage second = loadImage(arguments.at(1), parser.value(secondSizeOption));
+    if (first.isNull() || second.isNull()) {
+        return 1;
+    }
+
+    if (mode == QLatin1String("template")) {
+        double threshold = std::numeric_limits<double>::infinity();
+        if (parser.isSet(thresholdOption)) {
+            bool ok = false;
+            threshold = parser.value(thresholdOption).toDouble(&ok);
+            if (!ok) {
+                qWarning() << "invalid threshold" << parser.value(thresholdOption);
+                return 1;
+            }
+        }
+        Frame image = toFrame(first);
+        int originX = 0;
+        int originY = 0;
+        if (parser.isSet(roiOption)) {
+            const auto roi = parseRect(parser.value(roiOption));
+            if (!roi.has_value()) {
+                qWarning() << "invalid region of interest" << parser.value(roiOption);
+                return 1;
+            }
+            image = crop(image, roi.value());
+            originX = std::clamp(roi->x, 0, first.width());
+            originY = std::clamp(roi->y, 0, first.height());
+        }
+        const Frame templ = toFrame(second);
+        const Match match = parser.isSet(exhaustiveOption) ? matchTemplate(image, templ, threshold) : matchTemplatePyramid(image, templ, threshold);
+        result.insert(QStringLiteral("found"), match.found);
+        if (match.found) {
+            result.insert(QStringLiteral("score"), match.score);
+            result.insert(QStringLiteral("rect"), toJson({originX + match.x, originY + match.y, second.width(), second.height()}));
+        }
+    } else if (first.size() != second.size()) {
+        qWarning() << "images must have the same size" << first.size() << second.size();
+        return 1;
+    } else if (mode == QLatin1String("similarity")) {
+        result.insert(QStringLiteral("score"), normalizedSquaredDifference(toFrame(first), toFrame(second)));
+    } else if (mode == QLatin1String("diff")) {
+        const Difference difference = ::difference(toFrame(first), toFrame(second));
+        result.insert(QStringLiteral("pixels"), qint64(difference.pixels));
+        result.insert(QStringLiteral("rect"), toJson(difference.bounds));
+    } else {
+        qWarning() << "unsupported mode" << mode;
+        return 1;
+    }
+
+    printf("%s", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    return 0;
+}
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "tilehash.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+
+constexpr int perceptualGrid = 8; // 8x8 cells make the 64 bits of the average hash
+
+uint64_t mix(uint64_t hash, uint64_t value)
+{
+    value *= 0x9E3779B97F4A7C15ULL;
+    value ^= value >> 29;
+    hash ^= value;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return hash ^ (hash >> 32);
+}
+
+uint32_t luminance(uint32_t pixel)
+{
+    return (((pixel >> 16) & 0xff) * 77 + ((pixel >> 8) & 0xff) * 150 + (pixel & 0xff) * 29) >> 8;
+}
+
+TileHash hashTile(const Frame &frame, int column, int row, int tileSize)
+{
+    const int x0 = column * tileSize;
+    const int y0 = row * tileSize;
+    const int width = std::min(tileSize, frame.width - x0);
+    const int height = std::min(tileSize, frame.height - y0);
+
+    uint64_t exact = mix(uint64_t(width) << 32 | uint64_t(height), 0);
+    std::array<uint32_t, perceptualGrid * perceptualGrid> cellSums{};
+    std::array<uint32_t, perceptualGrid * perceptualGrid> cellCounts{};
+    uint64_t total = 0;
+
+    for (int y = 0; y < height; ++y) {
+        const uint32_t *pixels = frame.pixels(y0 + y) + x0;
+        int x = 0;
+        for (; x + 2 <= width; x += 2) {
+            uint64_t word = 0;
+            std::memcpy(&word, pixels + x, sizeof(word));
+            exact = mix(exact, word);
+        }
+        if (x < width) {
+            exact = mix(exact, pixels[x]);
+        }
+
+        const int cellRow = y * perceptualGrid / height;
+        for (x = 0; x < width; ++x) {
+            const uint32_t value = luminance(pixels[x]);
+            const int cell = cellRow * perceptualGrid + x * perceptualGrid / width;
+            cellSums[cell] += value;
+            ++cellCounts[cell];
+            total += value;
+        }
+    }
+
+    const uint32_t mean = total / (uint64_t(width) * height);
+    uint64_t perceptual = 0;
+    for (size_t cell = 0; cell < cellSums.size(); ++cell) {
+        if (cellCounts[cell] > 0 && cellSums[cell] > mean * cellCounts[cell]) {
+            perceptual |= uint64_t(1) << cell;
+        }
+    }
+    return {exact, perceptual, uint8_t(mean)};
+}
+
+bool similar(const TileHash &a, const TileHash &b, int tolerance)
+{
+    if (a.exact == b.exact) {
+        return true;
+    }
+    return tolerance > 0 && std::popcount(a.perceptual ^ b.perceptual) <= tolerance && std::abs(int(a.mean) - int(b.mean)) <= tolerance;
+}
+
+// Merges the changed tiles row by row: horizontal runs of changed tiles become rectangles, which grow downwards as long
+// as the next row has a run spanning exactly the same columns.
+class RectMerger
+{
+public:
+    RectMerger(const Frame &frame, int tileSize)
+        : m_frame(frame)
+        , m_tileSize(tileSize)
+    {
+    }
+
+    void addRun(int row, int firstColumn, int lastColumn)
+    {
+        const std::pair<int, int> run{firstColumn, lastColumn};
+        const int bottom = std::min((row + 1) * m_tileSize, m_frame.height);
+        const auto open = std::find_if(m_open.begin(), m_open.end(), [&run](const auto &entry) {
+            return entry.first == run;
+        });
+        if (open != m_open.end()) {
+            Rect &rect = m_rects[open->second];
+            rect.height = bottom - rect.y;
+            m_next.emplace_back(run, open->second);
+            return;
+        }
+        const int x = firstColumn * m_tileSize;
+        m_rects.push_back({x, row * m_tileSize, std::min((lastColumn + 1) * m_tileSize, m_frame.width) - x, bottom - row * m_tileSize});
+        m_next.emplace_back(run, m_rects.size() - 1);
+    }
+
+    void endRow()
+    {
+        m_open = std::exchange(m_next, {});
+    }
+
+    std::vector<Rect> rects()
+    {
+        return std::move(m_rects);
+    }
+
+private:
+    const Frame &m_frame;
+    const int m_tileSize;
+    std::vector<Rect> m_rects;
+    std::vector<std::pair<std::pair<int, int>, size_t>> m_open;
+    std::vector<std::pair<std::pair<int, int>, size_t>> m_next;
+};
+
+} // namespace
+
+TileHashes hashTiles(const Frame &frame, int tileSize)
+{
+    TileHashes hashes{frame.width, frame.height, tileSize, (frame.width + tileSize - 1) / tileSize, (frame.height + tileSize - 1) / tileSize, {}};
+    hashes.tiles.reserve(size_t(hashes.columns) * hashes.rows);
+    for (int row = 0; row < hashes.rows; ++row) {
+        for (int column = 0; column < hashes.columns; ++column) {
+            hashes.tiles.push_back(hashTile(frame, column, row, tileSize));
+        }
+    }
+    return hashes;
+}
+
+TileDifference tileDifference(const TileHashes &baseline, const Frame &frame, int tolerance, bool firstOnly)
+{
+    TileDifference difference;
+    if (baseline.width != frame.width || baseline.height != frame.height || baseline.tileSize <= 0) {
+        difference.tiles = std::max<size_t>(baseline.tiles.size(), 1);
+        difference.rects.push_back({0, 0, std::max(baseline.width, frame.width), std::max(baseline.height, frame.height)});
+        return difference;
+    }
+
+    const int tileSize = baseline.tileSize;
+    RectMerger merger(frame, tileSize);
+    for (int row = 0; row < baseline.rows; ++row) {
+        int runStart = -1;
+        for (int column = 0; column < baseline.columns; ++column) {
+            const bool changed = !similar(baseline.tiles[size_t(row) * baseline.columns + column], hashTile(frame, column, row, tileSize), tolerance);
+            if (changed) {
+                ++difference.tiles;
+                if (firstOnly) {
+                    merger.addRun(row, column, column);
+                    difference.rects = merger.rects();
+                    return difference;
+                }
+                if (runStart < 0) {
+                    runStart = column;
+                }
+            } else if (runStart >= 0) {
+                merger.addRun(row, runStart, column - 1);
+                runStart = -1;
+            }
+        }
+        if (runStart >= 0) {
+            merger.addRun(row, runStart, baseline.columns - 1);
+        }
+        merger.endRow();
+    }
+    difference.rects = merger.rects();
+    return difference;
+}
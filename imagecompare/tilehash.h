@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "comparison.h"
+
+// Frames are split into square tiles (the last column and row may be smaller) and every tile gets an exact hash of its
+// pixels plus a perceptual one: an 8x8 average hash of its luminance and the mean luminance itself. Comparing two
+// frames then is comparing their hashes, and the hashes of a baseline can be stored and reused.
+struct TileHash {
+    uint64_t exact = 0;
+    uint64_t perceptual = 0;
+    uint8_t mean = 0;
+};
+
+struct TileHashes {
+    int width = 0;
+    int height = 0;
+    int tileSize = 0;
+    int columns = 0;
+    int rows = 0;
+    std::vector<TileHash> tiles; // row major
+};
+
+TileHashes hashTiles(const Frame &frame, int tileSize);
+
+struct TileDifference {
+    size_t tiles = 0; // number of changed tiles
+    std::vector<Rect> rects; // changed tiles merged into rectangles
+};
+
+// Hashes frame tile by tile and compares against baseline. A tile counts as unchanged if its exact hash matches or,
+// with a tolerance > 0, if its average hash differs in at most tolerance bits and its mean luminance by at most
+// tolerance levels. With firstOnly the comparison stops at the first changed tile, for when yes or no is all we need.
+TileDifference tileDifference(const TileHashes &baseline, const Frame &frame, int tolerance, bool firstOnly);
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "inputmethod.h"
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusReply>
+#include <QDebug>
+#include <QGuiApplication>
+#if QT_VERSION < QT_VERSION_CHECK(6, 5, 0)
+#include <qpa/qplatformnativeinterface.h>
+#endif
+
+#include "tracing.h"
+
+namespace
+{
+constexpr auto objectPath = QLatin1String("/InputMethod");
+constexpr auto interfaceName = QLatin1String("org.kde.selenium_webdriver_at_spi.InputMethod");
+// Committing is a roundtrip on the input method's side, anything longer means it is stuck
+constexpr int commitTimeout = 2000;
+
+// One input method per nested KWin, the tests of several shards may share a session bus
+QString serviceName()
+{
+    return QStringLiteral("org.kde.selenium_webdriver_at_spi.InputMethod.kwin%1").arg(qEnvironmentVariable("KWIN_PID"));
+}
+} // namespace
+
+InputMethodContext::InputMethodContext(struct ::zwp_input_method_context_v1 *id)
+    : QtWayland::zwp_input_method_context_v1(id)
+{
+}
+
+InputMethodContext::~InputMethodContext()
+{
+    destroy();
+}
+
+void InputMethodContext::commitText(const QString &text)
+{
+    Tracing::Span span("input", "commitText");
+    span.setArg("characters", qint64(text.size()));
+    commit_string(m_serial, text);
+}
+
+void InputMethodContext::zwp_input_method_context_v1_commit_state(uint32_t serial)
+{
+    m_serial = serial;
+}
+
+InputMethod::InputMethod()
+    : QWaylandClientExtensionTemplate<InputMethod>(1)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    initialize();
+#else
+    // QWaylandClientExtensionTemplate invokes this with a QueuedConnection but we want it called immediately
+    QMetaObject::invokeMethod(this, "addRegistryListener", Qt::DirectConnection);
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    m_display = qGuiApp->nativeInterface<QNativeInterface::QWaylandApplication>()->display();
+#else
+    m_display = static_cast<struct wl_display *>(qGuiApp->platformNativeInterface()->nativeResourceForIntegration("wl_display"));
+#endif
+}
+
+InputMethod::~InputMethod() = default;
+
+bool InputMethod::registerService()
+{
+    auto bus = QDBusConnection::sessionBus();
+    if (!bus.registerObject(objectPath, this, QDBusConnection::ExportAllSlots)) {
+        qWarning() << "failed to register the input method object" << bus.lastError().message();
+        return false;
+    }
+    if (!bus.registerService(serviceName())) {
+        qWarning() << "failed to register" << serviceName() << bus.lastError().message();
+        return false;
+    }
+    return true;
+}
+
+bool InputMethod::CommitText(const QString &text)
+{
+    if (!m_context) {
+        // The text input may have been focused just now, its activation still be in flight
+        wl_display_roundtrip(m_display);
+    }
+    if (!m_context) {
+        return false;
+    }
+    m_context->commitText(text);
+    wl_display_roundtrip(m_display);
+    return true;
+}
+
+void InputMethod::zwp_input_method_v1_activate(struct ::zwp_input_method_context_v1 *id)
+{
+    m_context = std::make_unique<InputMethodContext>(id);
+}
+
+void InputMethod::zwp_input_method_v1_deactivate(struct ::zwp_input_method_context_v1 *context)
+{
+    if (m_context && m_context->object() == context) {
+        m_context.reset();
+    }
+}
+
+bool commitThroughInputMethod(const QString &text)
+{
+    Tracing::Span span("input", "commitThroughInputMethod");
+    auto message = QDBusMessage::createMethodCall(serviceName(), objectPath, interfaceName, QStringLiteral("CommitText"));
+    message << text;
+    const QDBusReply<bool> reply = QDBusConnection::sessionBus().call(message, QDBus::Block, commitTimeout);
+    if (!reply.isValid()) {
+        qDebug() << "no input method, text gets typed key by key:" << reply.error().message();
+        return false;
+    }
+    return reply.value();
+}
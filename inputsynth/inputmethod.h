@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <memory>
+
+#include "qwayland-input-method-unstable-v1.h"
+#include <QObject>
+#include <QWaylandClientExtensionTemplate>
+
+#include <wayland-client-protocol.h>
+
+// Acting as input method lets us hand whole strings to the focused text input: the application gets them as a single
+// commit, no matter whether the keyboard layout has keys for the characters.
+//
+// KWin only offers the protocol to the one input method it starts itself, so that is a long running instance of the
+// inputsynth (--input-method, see run.rb). The inputsynth runs performing actions ask it over D-Bus to commit their
+// text. Compositors without our input method leave them typing key by key, so everything must work without it.
+
+class InputMethodContext : public QtWayland::zwp_input_method_context_v1
+{
+public:
+    explicit InputMethodContext(struct ::zwp_input_method_context_v1 *id);
+    ~InputMethodContext() override;
+    Q_DISABLE_COPY_MOVE(InputMethodContext)
+
+    void commitText(const QString &text);
+
+protected:
+    void zwp_input_method_context_v1_commit_state(uint32_t serial) override;
+
+private:
+    uint32_t m_serial = 0;
+};
+
+class InputMethod : public QWaylandClientExtensionTemplate<InputMethod>, public QtWayland::zwp_input_method_v1
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.selenium_webdriver_at_spi.InputMethod")
+public:
+    explicit InputMethod();
+    ~InputMethod() override;
+    Q_DISABLE_COPY_MOVE(InputMethod)
+
+    // Puts the input method on the session bus for commitThroughInputMethod()
+    [[nodiscard]] bool registerService();
+
+public Q_SLOTS:
+    // Commits text to the focused text input, false when there is none
+    bool CommitText(const QString &text);
+
+protected:
+    void zwp_input_method_v1_activate(struct ::zwp_input_method_context_v1 *id) override;
+    void zwp_input_method_v1_deactivate(struct ::zwp_input_method_context_v1 *context) override;
+
+private:
+    wl_display *m_display = nullptr;
+    std::unique_ptr<InputMethodContext> m_context;
+};
+
+// Has the input method of our compositor commit text, false when there is no such input method or no text input has
+// focus. Returns once the compositor has the text.
+[[nodiscard]] bool commitThroughInputMethod(const QString &text);
@@ -6,20 +6,23 @@
 
 #include "interaction.h"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <ranges>
 #include <span>
 
 #include <linux/input-event-codes.h>
 
-#include <QDBusConnection>
-#include <QDBusInterface>
-#include <QDBusMessage>
-#include <QDBusMetaType>
-#include <QDBusReply>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QGuiApplication>
-#include <QScopeGuard>
 #include <QThread>
+#include <QtMath>
+
+#include "inputmethod.h"
+#include "keymap.h"
+#include "tracing.h"
 
 FakeInputInterface *s_interface;
 
@@ -29,31 +32,6 @@ QSet<int /* pressed button */> PointerAction::s_mouseButtons = {};
 
 namespace
 {
-// Magic offset stolen from kwin.
-constexpr auto EVDEV_OFFSET = 8U;
-
-struct LayoutNames {
-    QString shortName;
-    QString displayName;
-    QString longName;
-};
-
-QDBusArgument &operator<<(QDBusArgument &argument, const LayoutNames &layoutNames)
-{
-    argument.beginStructure();
-    argument << layoutNames.shortName << layoutNames.displayName << layoutNames.longName;
-    argument.endStructure();
-    return argument;
-}
-
-const QDBusArgument &operator>>(const QDBusArgument &argument, LayoutNames &layoutNames)
-{
-    argument.beginStructure();
-    argument >> layoutNames.shortName >> layoutNames.displayName >> layoutNames.longName;
-    argument.endStructure();
-    return argument;
-}
-
 [[nodiscard]] unsigned getUniqueId(const QString &idStr)
 {
     static unsigned lastId = 0;
@@ -66,8 +44,6 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, LayoutNames &layo
 
 } // namespace
 
-Q_DECLARE_METATYPE(LayoutNames)
-
 FakeInputInterface::FakeInputInterface()
     : QWaylandClientExtensionTemplate<FakeInputInterface>(ORG_KDE_KWIN_FAKE_INPUT_DESTROY_SINCE_VERSION)
 {
@@ -78,7 +54,7 @@ FakeInputInterface::FakeInputInterface()
 #else
         m_display = static_cast<struct wl_display *>(qGuiApp->platformNativeInterface()->nativeResourceForIntegration("wl_display"));
 #endif
-        wl_display_roundtrip(m_display);
+        sync();
 
         Q_EMIT readyChanged();
     };
@@ -100,218 +76,132 @@ void FakeInputInterface::roundtrip(bool touch)
     if (touch) {
         touch_frame();
     }
-    wl_display_roundtrip(s_interface->m_display);
+    sync();
 }
 
-void FakeInputInterface::sendKey(const std::vector<quint32> &linuxModifiers, quint32 linuxKeyCode, wl_keyboard_key_state keyState)
+void FakeInputInterface::sync()
+{
+    Tracing::Span span("wayland", "roundtrip");
+    Tracing::count("wayland roundtrips");
+    wl_display_roundtrip(m_display);
+}
+
+void FakeInputInterface::sendKey(std::span<const quint32> linuxModifiers, quint32 linuxKeyCode, wl_keyboard_key_state keyState)
 {
     if (keyState == WL_KEYBOARD_KEY_STATE_PRESSED) {
+        // Modifiers pressed for an earlier key stay down as long as the following keys need them too. Only the
+        // difference gets pressed or released.
+        for (auto it = m_keyModifiers.begin(); it != m_keyModifiers.end();) {
+            if (std::ranges::find(linuxModifiers, *it) != linuxModifiers.end()) {
+                ++it;
+                continue;
+            }
+            if (!m_heldModifiers.contains(*it)) {
+                qDebug() << "  releasing modifier" << *it;
+                keyboard_key(*it, WL_KEYBOARD_KEY_STATE_RELEASED);
+            }
+            it = m_keyModifiers.erase(it);
+        }
         for (const auto &modifier : linuxModifiers) {
-            qDebug() << "  pressing modifier" << modifier;
-            keyboard_key(modifier, WL_KEYBOARD_KEY_STATE_PRESSED);
-            wl_display_roundtrip(m_display);
+            if (m_keyModifiers.contains(modifier)) {
+                continue;
+            }
+            m_keyModifiers.insert(modifier);
+            if (!m_heldModifiers.contains(modifier)) {
+                qDebug() << "  pressing modifier" << modifier;
+                keyboard_key(modifier, WL_KEYBOARD_KEY_STATE_PRESSED);
+            }
         }
     }
 
     qDebug() << "    key (state)" << linuxKeyCode << keyState;
     keyboard_key(linuxKeyCode, keyState);
-    wl_display_roundtrip(m_display);
-
-    if (keyState == WL_KEYBOARD_KEY_STATE_RELEASED) {
-        for (const auto &modifier : linuxModifiers) {
-            qDebug() << "  releasing modifier" << modifier;
-            keyboard_key(modifier, WL_KEYBOARD_KEY_STATE_RELEASED);
-            wl_display_roundtrip(m_display);
-        }
-    }
+    // Requests are processed in order, one sync for all of them is enough
+    sync();
 }
 
-BaseAction::BaseAction()
+void FakeInputInterface::sendModifier(quint32 linuxKeyCode, wl_keyboard_key_state keyState)
 {
+    if (keyState == WL_KEYBOARD_KEY_STATE_PRESSED) {
+        const bool down = m_heldModifiers.contains(linuxKeyCode) || m_keyModifiers.contains(linuxKeyCode);
+        m_heldModifiers.insert(linuxKeyCode);
+        if (down) {
+            qDebug() << "  modifier already down" << linuxKeyCode;
+            return;
+        }
+    } else {
+        m_heldModifiers.remove(linuxKeyCode);
+        m_keyModifiers.remove(linuxKeyCode);
+    }
+    qDebug() << "    modifier (state)" << linuxKeyCode << keyState;
+    keyboard_key(linuxKeyCode, keyState);
+    sync();
 }
 
-BaseAction::~BaseAction()
+void FakeInputInterface::releaseKeyModifiers()
 {
+    bool released = false;
+    for (const auto &modifier : std::as_const(m_keyModifiers)) {
+        if (!m_heldModifiers.contains(modifier)) {
+            qDebug() << "  releasing modifier" << modifier;
+            keyboard_key(modifier, WL_KEYBOARD_KEY_STATE_RELEASED);
+            released = true;
+        }
+    }
+    m_keyModifiers.clear();
+    if (released) {
+        sync();
+    }
 }
 
 KeyboardAction::KeyboardAction(const QChar &key, wl_keyboard_key_state keyState)
-    : BaseAction()
-    , m_keysym(charToKeysym(key))
-    , m_context(xkb_context_new(XKB_CONTEXT_NO_FLAGS))
-    , m_ruleNames({.rules = nullptr, .model = nullptr, .layout = defaultLayout().constData(), .variant = nullptr, .options = nullptr})
-    , m_keymap(xkb_keymap_new_from_names(m_context.get(), &m_ruleNames, XKB_KEYMAP_COMPILE_NO_FLAGS))
-    , m_state(xkb_state_new(m_keymap.get()))
-    , m_layout(xkb_state_serialize_layout(m_state.get(), XKB_STATE_LAYOUT_EFFECTIVE))
-    , m_modCount(xkb_keymap_num_mods(m_keymap.get()))
+    : m_keysym(charToKeysym(key))
     , m_keyState(keyState)
 {
-    Q_ASSERT(!defaultLayout().isEmpty());
     Q_ASSERT(m_keysym != XKB_KEY_NoSymbol);
+    Tracing::Span span("xkb", "resolveKey");
 
     qDebug() << "looking for keysym" << m_keysym << "for char" << key;
-
-    // Load the modifier keycodes. This walks all modifiers and maps them to keycodes. Effectively just resolving
-    // that Alt is 123 and Ctrl is 456 etc.
-    loadModifiers();
-
-    // Once we know our modifiers we can resolve the actual key by iterating the keysyms.
-    for (const auto &keycode : std::views::iota(xkb_keymap_min_keycode(m_keymap.get()), xkb_keymap_max_keycode(m_keymap.get()))) {
-        for (const auto &level : std::views::iota(0U, xkb_keymap_num_levels_for_key(m_keymap.get(), keycode, m_layout))) {
-            const xkb_keysym_t *syms = nullptr;
-            uint num_syms = xkb_keymap_key_get_syms_by_level(m_keymap.get(), keycode, m_layout, level, &syms);
-            for (const auto &sym : std::span{syms, num_syms}) {
-                if (sym != m_keysym) {
-                    continue;
-                }
-                qDebug() << "found keysym" << keycode << level;
-                if (m_level != XKB_LEVEL_INVALID && m_level < level) {
-                    continue;
-                }
-                m_keycode = keycode - EVDEV_OFFSET;
-                m_level = level;
-                // We found the key. As a last step we'll need to resolve the modifiers required to trigger this
-                // key. e.g. to produce 'A' we need to press the 'Shift' modifier before the 'a' key.
-                resolveModifiersForKey(keycode);
-            }
-        }
+    if (const auto resolved = Keymap::instance().lookup(m_keysym)) {
+        m_keycode = resolved->keycode;
+        m_modifiers = resolved->modifiers;
+        return;
     }
-    Q_ASSERT(m_keycode != XKB_KEYCODE_INVALID);
-}
-
-KeyboardAction::~KeyboardAction()
-{
+    qWarning() << "no key produces" << key << "on the current layout";
 }
 
 void KeyboardAction::perform()
 {
-    s_interface->sendKey(linuxModifiers(), m_keycode, m_keyState);
-}
-
-[[nodiscard]] std::vector<quint32> KeyboardAction::linuxModifiers() const
-{
-    if (m_level == 0) {
-        return {};
-    }
-
-    qDebug() << m_modifiers;
-    std::vector<quint32> ret;
-    for (const auto &modifier : m_modifiers) {
-        if (m_modifierNameToSym.contains(modifier)) {
-            const auto modifierSym = m_modifierNameToSym.value(modifier);
-            const auto modifierCodes = m_modifierSymToCodes.value(modifierSym);
-            // Returning the first possible code only is a bit meh but seems to work fine so far.
-            ret.push_back(modifierCodes.at(0));
-        }
+    Tracing::Span span("input", "key");
+    if (m_keycode == XKB_KEYCODE_INVALID) {
+        return;
     }
-    if (ret.empty()) {
-        qCritical("Unknown level!");
-        return {};
+    if (isModifier()) {
+        s_interface->sendModifier(m_keycode, m_keyState);
+        return;
     }
-    return ret;
-}
-
-QByteArray KeyboardAction::defaultLayout() const
-{
-    static const auto layout = [] {
-        if (qEnvironmentVariableIsSet("KWIN_XKB_DEFAULT_KEYMAP")) {
-            auto layout = qgetenv("XKB_DEFAULT_LAYOUT");
-            qDebug() << "synthesizing environment-influenced layout:" << layout;
-            return layout;
-        }
-
-        // When running outside a nested kwin we'll need to follow whatever kwin has defined as layout.
-
-        qDBusRegisterMetaType<LayoutNames>();
-        qDBusRegisterMetaType<QList<LayoutNames>>();
-
-        QDBusMessage layoutMessage = QDBusMessage::createMethodCall(QStringLiteral("org.kde.keyboard"),
-                                                                    QStringLiteral("/Layouts"),
-                                                                    QStringLiteral("org.kde.KeyboardLayouts"),
-                                                                    QStringLiteral("getLayout"));
-        QDBusReply<int> layoutReply = QDBusConnection::sessionBus().call(layoutMessage);
-        if (!layoutReply.isValid()) {
-            qWarning() << "Failed to get layout index" << layoutReply.error().message() << "defaulting to us";
-            return QByteArrayLiteral("us");
-        }
-        const auto layoutIndex = layoutReply.value();
-
-        QDBusMessage listMessage = QDBusMessage::createMethodCall(QStringLiteral("org.kde.keyboard"),
-                                                                  QStringLiteral("/Layouts"),
-                                                                  QStringLiteral("org.kde.KeyboardLayouts"),
-                                                                  QStringLiteral("getLayoutsList"));
-        QDBusReply<QList<LayoutNames>> listReply = QDBusConnection::sessionBus().call(listMessage);
-        if (!listReply.isValid()) {
-            qWarning() << "Failed to get layout list" << listReply.error().message() << "defaulting to us";
-            return QByteArrayLiteral("us");
-        }
-
-        auto layout = listReply.value().at(layoutIndex).shortName.toUtf8();
-        qDebug() << "synthesizing layout:" << layout;
-        return layout;
-    }();
-    Q_ASSERT(!layout.isEmpty());
-    return layout;
+    s_interface->sendKey(linuxModifiers(), m_keycode, m_keyState);
 }
 
-void KeyboardAction::loadModifiers()
+bool KeyboardAction::isModifier() const
 {
     static constexpr auto modifierKeys = {XKB_KEY_Shift_L,
+                                          XKB_KEY_Shift_R,
+                                          XKB_KEY_Control_L,
+                                          XKB_KEY_Control_R,
                                           XKB_KEY_Alt_L,
+                                          XKB_KEY_Alt_R,
                                           XKB_KEY_Meta_L,
-                                          XKB_KEY_Mode_switch,
+                                          XKB_KEY_Meta_R,
                                           XKB_KEY_Super_L,
                                           XKB_KEY_Super_R,
-                                          XKB_KEY_Hyper_L,
-                                          XKB_KEY_Hyper_R,
-                                          XKB_KEY_ISO_Level3_Shift,
-                                          XKB_KEY_ISO_Level5_Shift};
-
-    for (const auto &keycode : std::views::iota(xkb_keymap_min_keycode(m_keymap.get()), xkb_keymap_max_keycode(m_keymap.get()))) {
-        for (const auto &level : std::views::iota(0U, xkb_keymap_num_levels_for_key(m_keymap.get(), keycode, m_layout))) {
-            const xkb_keysym_t *syms = nullptr;
-            uint num_syms = xkb_keymap_key_get_syms_by_level(m_keymap.get(), keycode, m_layout, level, &syms);
-            for (const auto &sym : std::span{syms, num_syms}) {
-                if (const auto it = std::ranges::find(modifierKeys, sym); it == modifierKeys.end()) {
-                    continue;
-                }
-
-                m_modifierSymToCodes[sym].push_back(keycode - EVDEV_OFFSET);
-
-                // The sym is a modifier. Find out which by pressing the key and checking which modifiers activate.
-                xkb_state_update_key(m_state.get(), keycode, XKB_KEY_DOWN);
-                auto up = qScopeGuard([this, &keycode] {
-                    xkb_state_update_key(m_state.get(), keycode, XKB_KEY_UP);
-                });
-
-                for (const auto &mod : std::views::iota(0U, m_modCount)) {
-                    if (xkb_state_mod_index_is_active(m_state.get(), mod, XKB_STATE_MODS_EFFECTIVE) <= 0) {
-                        continue;
-                    }
-                    m_modifierNameToSym[QString::fromUtf8(xkb_keymap_mod_get_name(m_keymap.get(), mod))] = sym;
-                    break;
-                }
-            }
-        }
-    }
+                                          XKB_KEY_ISO_Level3_Shift};
+    return std::ranges::find(modifierKeys, m_keysym) != modifierKeys.end();
 }
 
-void KeyboardAction::resolveModifiersForKey(xkb_keycode_t keycode)
+[[nodiscard]] std::span<const quint32> KeyboardAction::linuxModifiers() const
 {
-    static constexpr auto maxMasks = 1; // we only care about a single mask because we need only one way to access the key
-    std::array<xkb_mod_mask_t, maxMasks> mask{};
-    const auto maskSize = xkb_keymap_key_get_mods_for_level(m_keymap.get(), keycode, m_layout, m_level, mask.data(), mask.size());
-    for (const auto &mask : std::span{mask.data(), maskSize}) {
-        for (const auto &mod : std::views::iota(0U, m_modCount)) {
-            if ((mask & (1 << mod)) == 0) {
-                continue;
-            }
-            const auto name = xkb_keymap_mod_get_name(m_keymap.get(), mod);
-            const auto qName = QString::fromUtf8(name);
-            if (!m_modifiers.contains(qName)) {
-                m_modifiers.push_back(qName);
-            }
-        }
-    }
+    return m_modifiers;
 }
 
 xkb_keysym_t KeyboardAction::charToKeysym(const QChar &key)
@@ -356,18 +246,33 @@ xkb_keysym_t KeyboardAction::charToKeysym(const QChar &key)
     return xkb_utf32_to_keysym(key.unicode());
 }
 
-PauseAction::PauseAction(unsigned long duration)
-    : BaseAction()
-    , m_duration(duration)
+TextAction::TextAction(const QString &text)
+    : m_text(text)
+{
+}
+
+void TextAction::perform()
 {
+    Tracing::Span span("input", "text");
+    if (commitThroughInputMethod(m_text)) {
+        return;
+    }
+
+    for (const auto &character : std::as_const(m_text)) {
+        KeyboardAction(character, WL_KEYBOARD_KEY_STATE_PRESSED).perform();
+        KeyboardAction(character, WL_KEYBOARD_KEY_STATE_RELEASED).perform();
+    }
+    s_interface->releaseKeyModifiers();
 }
 
-PauseAction::~PauseAction()
+PauseAction::PauseAction(unsigned long duration)
+    : m_duration(duration)
 {
 }
 
 void PauseAction::perform()
 {
+    Tracing::Span span("input", "pause");
     QThread::msleep(m_duration);
 }
 
@@ -379,12 +284,9 @@ WheelAction::WheelAction(const QString &id, const QPoint &pos, const QPoint &del
 {
 }
 
-WheelAction::~WheelAction()
-{
-}
-
 void WheelAction::perform()
 {
+    Tracing::Span span("input", "wheel");
     PointerAction::s_positions[m_uniqueId] = m_pos;
     s_interface->pointer_motion_absolute(wl_fixed_from_int(m_pos.x()), wl_fixed_from_int(m_pos.y()));
     s_interface->roundtrip();
@@ -410,10 +312,6 @@ PointerAction::PointerAction(PointerKind pointerType, const QString &id, ActionT
 {
 }
 
-PointerAction::~PointerAction()
-{
-}
-
 void PointerAction::setPosition(const QPoint &pos, Origin origin)
 {
     m_pos = pos;
@@ -430,6 +328,7 @@ void PointerAction::perform()
         {static_cast<int>(Button::Back), BTN_BACK},
     };
 
+    Tracing::Span span("input", "pointer");
     switch (m_actionType) {
     case ActionType::Move: {
         auto lastPosIt = s_positions.find(m_uniqueId);
@@ -562,4 +461,78 @@ void PointerAction::perform()
     qWarning() << "Ignored an unknown action type" << static_cast<int>(m_actionType);
 }
 
+GestureAction::GestureAction(Kind kind, const Parameters &parameters)
+    : m_kind(kind)
+    , m_parameters(parameters)
+{
+    if (m_kind == Kind::Pinch || m_kind == Kind::Rotate) {
+        m_parameters.fingers = 2;
+    }
+    m_parameters.fingers = std::clamp(m_parameters.fingers, 1, maxFingers);
+    m_parameters.rate = std::clamp(m_parameters.rate, 1, 1000);
+    if (m_kind == Kind::Fling) {
+        m_parameters.delta = m_parameters.velocity * (m_parameters.duration / 1000.0);
+    }
+}
+
+std::array<QPointF, GestureAction::maxFingers> GestureAction::fingersAt(double progress) const
+{
+    std::array<QPointF, maxFingers> fingers{};
+    switch (m_kind) {
+    case Kind::Pinch:
+    case Kind::Rotate: {
+        const double span = m_parameters.startSpan + (m_parameters.endSpan - m_parameters.startSpan) * progress;
+        const double radians = qDegreesToRadians(m_parameters.startAngle + m_parameters.angle * progress);
+        const QPointF offset(std::cos(radians) * span / 2, std::sin(radians) * span / 2);
+        fingers.at(0) = m_parameters.center - offset;
+        fingers.at(1) = m_parameters.center + offset;
+        break;
+    }
+    case Kind::Swipe:
+    case Kind::Fling:
+        for (const auto &finger : std::views::iota(0, m_parameters.fingers)) {
+            const double x = (finger - (m_parameters.fingers - 1) / 2.0) * m_parameters.spacing;
+            fingers.at(finger) = m_parameters.center + QPointF(x, 0) + m_parameters.delta * progress;
+        }
+        break;
+    }
+    return fingers;
+}
+
+void GestureAction::perform()
+{
+    Tracing::Span span("input", "gesture");
+    const int frames = std::max(1, int(std::lround(m_parameters.duration * m_parameters.rate / 1000.0)));
+    const qint64 frameInterval = 1000000000LL / m_parameters.rate;
+    span.setArg("frames", frames);
+
+    std::array<unsigned, maxFingers> ids{};
+    for (const auto &finger : std::views::iota(0, m_parameters.fingers)) {
+        ids.at(finger) = getUniqueId(QStringLiteral("gesture finger %1").arg(finger));
+    }
+    auto send = [this, &ids](double progress, auto request) {
+        const auto fingers = fingersAt(progress);
+        for (const auto &finger : std::views::iota(0, m_parameters.fingers)) {
+            std::invoke(request, s_interface, ids.at(finger), wl_fixed_from_double(fingers.at(finger).x()), wl_fixed_from_double(fingers.at(finger).y()));
+        }
+        s_interface->roundtrip(true);
+    };
+
+    qDebug() << "gesture" << static_cast<int>(m_kind) << "with" << m_parameters.fingers << "fingers over" << frames << "frames";
+    send(0, &FakeInputInterface::touch_down);
+    QElapsedTimer timer;
+    timer.start();
+    for (const auto &frame : std::views::iota(1, frames + 1)) {
+        // Sleep until the frame is due rather than for a fixed time, so the time spent sending doesn't add up
+        if (const qint64 wait = frame * frameInterval - timer.nsecsElapsed(); wait > 0) {
+            QThread::usleep(wait / 1000);
+        }
+        send(double(frame) / frames, &FakeInputInterface::touch_motion);
+    }
+    for (const auto &finger : std::views::iota(0, m_parameters.fingers)) {
+        s_interface->touch_up(ids.at(finger));
+    }
+    s_interface->roundtrip(true);
+}
+
 #include "moc_interaction.cpp"
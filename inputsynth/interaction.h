@@ -6,12 +6,17 @@
 
 #pragma once
 
+#include <array>
 #include <memory>
+#include <span>
+#include <variant>
 
 #include "qwayland-fake-input.h"
 #include <QHash>
 #include <QMap>
 #include <QPoint>
+#include <QPointF>
+#include <QSet>
 #include <QWaylandClientExtensionTemplate>
 #if QT_VERSION < QT_VERSION_CHECK(6, 5, 0)
 #include <qpa/qplatformnativeinterface.h>
@@ -20,33 +25,6 @@
 #include <wayland-client-protocol.h>
 #include <xkbcommon/xkbcommon.h>
 
-namespace std
-{
-template<>
-struct default_delete<xkb_context> {
-    void operator()(xkb_context *ptr) const
-    {
-        xkb_context_unref(ptr);
-    }
-};
-
-template<>
-struct default_delete<xkb_keymap> {
-    void operator()(xkb_keymap *ptr) const
-    {
-        xkb_keymap_unref(ptr);
-    }
-};
-
-template<>
-struct default_delete<xkb_state> {
-    void operator()(xkb_state *ptr) const
-    {
-        xkb_state_unref(ptr);
-    }
-};
-} // namespace std
-
 class FakeInputInterface : public QWaylandClientExtensionTemplate<FakeInputInterface>, public QtWayland::org_kde_kwin_fake_input
 {
     Q_OBJECT
@@ -56,7 +34,14 @@ public:
     ~FakeInputInterface() override;
 
     void roundtrip(bool touch = false);
-    void sendKey(const std::vector<quint32> &linuxModifiers, quint32 linuxKeyCode, wl_keyboard_key_state keyState);
+    // Sends a key along with the modifiers it needs to produce its character. Modifiers are tracked across keys:
+    // they are pressed when a key needs them and released only once a key doesn't, or by releaseKeyModifiers().
+    void sendKey(std::span<const quint32> linuxModifiers, quint32 linuxKeyCode, wl_keyboard_key_state keyState);
+    // Explicit modifier key actions (e.g. Keys.SHIFT). A modifier held this way stays down regardless of what the
+    // keys need and is never pressed twice.
+    void sendModifier(quint32 linuxKeyCode, wl_keyboard_key_state keyState);
+    // Lets go of the modifiers pressed on behalf of keys. Anything but key actions shouldn't see them.
+    void releaseKeyModifiers();
 
     Q_DISABLE_COPY_MOVE(FakeInputInterface)
 
@@ -64,24 +49,20 @@ Q_SIGNALS:
     void readyChanged();
 
 private:
+    // Waits for the compositor to have processed everything we sent
+    void sync();
+
     bool m_ready = false;
     wl_display *m_display = nullptr;
+    QSet<quint32> m_keyModifiers; // pressed because keys needed them
+    QSet<quint32> m_heldModifiers; // pressed by explicit modifier actions
 };
 
 extern FakeInputInterface *s_interface;
 
-class BaseAction
-{
-public:
-    explicit BaseAction();
-    virtual ~BaseAction();
-
-    virtual void perform() = 0;
-
-    Q_DISABLE_COPY_MOVE(BaseAction)
-};
-
-class KeyboardAction : public BaseAction
+// Actions are plain values kept in one contiguous vector, a recorded gesture of thousands of steps is a single
+// allocation.
+class KeyboardAction
 {
 public:
     /**
@@ -98,69 +79,56 @@ public:
      *
      * So we end up resolving keycodes through XKB...
      * XKB resolution entails iterating all levels in all keycodes to look at all keysyms and eventually find the one
-     * we are looking for. It's a bit verbose but it is what it is.
+     * we are looking for. It's a bit verbose but it is what it is. Keymap does it once per layout and caches the
+     * result on disk.
      */
     explicit KeyboardAction(const QChar &key, wl_keyboard_key_state keyState);
-    ~KeyboardAction() override;
 
-    void perform() override;
+    void perform();
 
-    std::vector<quint32> linuxModifiers() const;
+    std::span<const quint32> linuxModifiers() const;
+    // Whether the key is a modifier itself
+    bool isModifier() const;
 
 private:
-    // The default layout used by KWin. This is either environment-defined (for nested KWins) or read from its DBus API
-    // when dealing with a native KWin.
-    QByteArray defaultLayout() const;
-
-    void loadModifiers();
-
-    // Resolve the modifiers required to produce a certain key.
-    // XKB API is again a bit awkward here because it spits out modifier string names rather than codes or syms
-    // so this function implicitly relies on loadModifiers() having first resolved modifiers to their stringy
-    // representation.
-    // Besides that it is straight forward. We request a modifier mask, check which modifiers are active in the mask
-    // and based on that we can identifier the keycodes we need to press.
-    void resolveModifiersForKey(xkb_keycode_t keycode);
-
     xkb_keysym_t charToKeysym(const QChar &key);
 
     xkb_keysym_t m_keysym = XKB_KEY_NoSymbol;
     xkb_keycode_t m_keycode = XKB_KEYCODE_INVALID;
-    xkb_level_index_t m_level = XKB_LEVEL_INVALID;
-    QStringList m_modifiers;
+    std::span<const quint32> m_modifiers; // points into the Keymap
+    wl_keyboard_key_state m_keyState;
+};
 
-    std::unique_ptr<xkb_context> m_context;
-    xkb_rule_names m_ruleNames;
-    std::unique_ptr<xkb_keymap> m_keymap;
-    std::unique_ptr<xkb_state> m_state;
-    xkb_layout_index_t m_layout;
+class TextAction
+{
+public:
+    // Commits text in one go through the input method. When there is no input method, or no text input has focus,
+    // the text is typed key by key instead.
+    explicit TextAction(const QString &text);
 
-    xkb_mod_index_t m_modCount;
-    QMap<uint, QList<xkb_keycode_t>> m_modifierSymToCodes;
-    QMap<QString, uint> m_modifierNameToSym;
+    void perform();
 
-    wl_keyboard_key_state m_keyState;
+private:
+    QString m_text;
 };
 
-class PauseAction : public BaseAction
+class PauseAction
 {
 public:
     explicit PauseAction(unsigned long duration);
-    ~PauseAction() override;
 
-    void perform() override;
+    void perform();
 
 private:
     unsigned long m_duration = 0;
 };
 
-class WheelAction : public BaseAction
+class WheelAction
 {
 public:
     explicit WheelAction(const QString &id, const QPoint &pos, const QPoint &deltaPos, unsigned long duration);
-    ~WheelAction() override;
 
-    void perform() override;
+    void perform();
 
 private:
     unsigned m_uniqueId;
@@ -169,7 +137,7 @@ private:
     unsigned long m_duration = 0;
 };
 
-class PointerAction : public BaseAction
+class PointerAction
 {
 public:
     // https://github.com/SeleniumHQ/selenium/blob/6620bce4e8e9da1fee3ec5a5547afa7dece3f80e/py/selenium/webdriver/common/actions/interaction.py#L30
@@ -205,10 +173,9 @@ public:
     };
 
     explicit PointerAction(PointerKind pointerType, const QString &id, ActionType actionType, Button button, unsigned long duration);
-    ~PointerAction() override;
 
     void setPosition(const QPoint &pos, Origin origin);
-    void perform() override;
+    void perform();
 
 private:
     static QHash<unsigned /* unique id */, QPoint> s_positions;
@@ -225,3 +192,45 @@ private:
 
     friend class WheelAction;
 };
+
+// Touch gestures described by a handful of parameters rather than a trail of moves. All fingers move in the same
+// touch frame, one frame per refresh, like a touchscreen reports them.
+class GestureAction
+{
+public:
+    enum class Kind {
+        Pinch, // two fingers spreading from startSpan to endSpan apart
+        Rotate, // two fingers turning by angle around the center
+        Swipe, // fingers moving by delta side by side
+        Fling, // a quick swipe, the fingers lift at velocity
+    };
+
+    static constexpr auto maxFingers = 5;
+
+    struct Parameters {
+        QPointF center;
+        double startSpan = 200; // distance between the fingers of a pinch or rotation
+        double endSpan = 200;
+        double startAngle = 0; // degrees, of the line through the two fingers
+        double angle = 0; // degrees the fingers turn by
+        int fingers = 2;
+        double spacing = 80; // distance between neighbouring fingers of a swipe
+        QPointF delta; // distance a swipe moves
+        QPointF velocity; // pixels per second a fling moves at
+        unsigned long duration = 300; // milliseconds
+        int rate = 60; // frames per second
+    };
+
+    explicit GestureAction(Kind kind, const Parameters &parameters);
+
+    void perform();
+
+private:
+    // Where the fingers are at progress (0 to 1) into the gesture
+    [[nodiscard]] std::array<QPointF, maxFingers> fingersAt(double progress) const;
+
+    Kind m_kind;
+    Parameters m_parameters;
+};
+
+using Action = std::variant<KeyboardAction, TextAction, PauseAction, WheelAction, PointerAction, GestureAction>;
@@ -0,0 +1,332 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "keymap.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <ranges>
+
+#include <QCryptographicHash>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusReply>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMap>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QStandardPaths>
+
+#include "tracing.h"
+
+namespace std
+{
+template<>
+struct default_delete<xkb_context> {
+    void operator()(xkb_context *ptr) const
+    {
+        xkb_context_unref(ptr);
+    }
+};
+
+template<>
+struct default_delete<xkb_keymap> {
+    void operator()(xkb_keymap *ptr) const
+    {
+        xkb_keymap_unref(ptr);
+    }
+};
+
+template<>
+struct default_delete<xkb_state> {
+    void operator()(xkb_state *ptr) const
+    {
+        xkb_state_unref(ptr);
+    }
+};
+} // namespace std
+
+namespace
+{
+// Magic offset stolen from kwin.
+constexpr auto EVDEV_OFFSET = 8U;
+// Bump when the records change
+constexpr quint32 formatVersion = 1;
+constexpr std::array<char, 4> formatMagic{'S', 'W', 'K', 'M'};
+
+struct LayoutNames {
+    QString shortName;
+    QString displayName;
+    QString longName;
+};
+
+QDBusArgument &operator<<(QDBusArgument &argument, const LayoutNames &layoutNames)
+{
+    argument.beginStructure();
+    argument << layoutNames.shortName << layoutNames.displayName << layoutNames.longName;
+    argument.endStructure();
+    return argument;
+}
+
+const QDBusArgument &operator>>(const QDBusArgument &argument, LayoutNames &layoutNames)
+{
+    argument.beginStructure();
+    argument >> layoutNames.shortName >> layoutNames.displayName >> layoutNames.longName;
+    argument.endStructure();
+    return argument;
+}
+} // namespace
+
+Q_DECLARE_METATYPE(LayoutNames)
+
+namespace
+{
+// The default layout used by KWin. This is either environment-defined (for nested KWins) or read from its DBus API
+// when dealing with a native KWin.
+QByteArray defaultLayout()
+{
+    if (qEnvironmentVariableIsSet("KWIN_XKB_DEFAULT_KEYMAP")) {
+        auto layout = qgetenv("XKB_DEFAULT_LAYOUT");
+        qDebug() << "synthesizing environment-influenced layout:" << layout;
+        return layout;
+    }
+
+    // When running outside a nested kwin we'll need to follow whatever kwin has defined as layout.
+
+    qDBusRegisterMetaType<LayoutNames>();
+    qDBusRegisterMetaType<QList<LayoutNames>>();
+
+    QDBusMessage layoutMessage = QDBusMessage::createMethodCall(QStringLiteral("org.kde.keyboard"),
+                                                                QStringLiteral("/Layouts"),
+                                                                QStringLiteral("org.kde.KeyboardLayouts"),
+                                                                QStringLiteral("getLayout"));
+    QDBusReply<int> layoutReply = QDBusConnection::sessionBus().call(layoutMessage);
+    if (!layoutReply.isValid()) {
+        qWarning() << "Failed to get layout index" << layoutReply.error().message() << "defaulting to us";
+        return QByteArrayLiteral("us");
+    }
+    const auto layoutIndex = layoutReply.value();
+
+    QDBusMessage listMessage = QDBusMessage::createMethodCall(QStringLiteral("org.kde.keyboard"),
+                                                              QStringLiteral("/Layouts"),
+                                                              QStringLiteral("org.kde.KeyboardLayouts"),
+                                                              QStringLiteral("getLayoutsList"));
+    QDBusReply<QList<LayoutNames>> listReply = QDBusConnection::sessionBus().call(listMessage);
+    if (!listReply.isValid()) {
+        qWarning() << "Failed to get layout list" << listReply.error().message() << "defaulting to us";
+        return QByteArrayLiteral("us");
+    }
+
+    auto layout = listReply.value().at(layoutIndex).shortName.toUtf8();
+    Tracing::instant("xkb", "layout", {{QStringLiteral("layout"), QString::fromUtf8(layout)}});
+    qDebug() << "synthesizing layout:" << layout;
+    return layout;
+}
+
+const char *nullIfEmpty(const QByteArray &value)
+{
+    return value.isEmpty() ? nullptr : value.constData();
+}
+
+QString cachePath(xkb_context *context, const xkb_rule_names &names)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(formatVersion));
+    for (const char *name : {names.rules, names.model, names.layout, names.variant, names.options}) {
+        hash.addData(QByteArrayView(name));
+        hash.addData(QByteArrayView("\n"));
+    }
+    // Updating xkeyboard-config replaces the files, changing the modification time of their directory
+    for (const auto &index : std::views::iota(0U, xkb_context_num_include_paths(context))) {
+        const QFileInfo symbols(QDir(QFile::decodeName(xkb_context_include_path_get(context, index))).filePath(QStringLiteral("symbols")));
+        hash.addData(symbols.absoluteFilePath().toUtf8());
+        hash.addData(QByteArray::number(symbols.lastModified().toMSecsSinceEpoch()));
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QLatin1String("/selenium-webdriver-at-spi/keymaps/")
+        + QString::fromLatin1(hash.result().toHex()) + QLatin1String(".keymap");
+}
+} // namespace
+
+const Keymap &Keymap::instance()
+{
+    static const Keymap keymap;
+    return keymap;
+}
+
+Keymap::Keymap()
+{
+    Tracing::Span span("xkb", "loadKeymap");
+
+    // Unset names default to the environment in xkbcommon. They are spelled out so they make it into the cache key.
+    const QByteArray rules = qgetenv("XKB_DEFAULT_RULES");
+    const QByteArray model = qgetenv("XKB_DEFAULT_MODEL");
+    const QByteArray layout = defaultLayout();
+    const QByteArray variant = qgetenv("XKB_DEFAULT_VARIANT");
+    const QByteArray options = qgetenv("XKB_DEFAULT_OPTIONS");
+    Q_ASSERT(!layout.isEmpty());
+    const xkb_rule_names names{.rules = nullIfEmpty(rules),
+                               .model = nullIfEmpty(model),
+                               .layout = nullIfEmpty(layout),
+                               .variant = nullIfEmpty(variant),
+                               .options = nullIfEmpty(options)};
+
+    std::unique_ptr<xkb_context> context(xkb_context_new(XKB_CONTEXT_NO_FLAGS));
+    const QString path = cachePath(context.get(), names);
+    if (map(path)) {
+        span.setArg("cached", true);
+        return;
+    }
+    span.setArg("cached", false);
+
+    m_data = build(context.get(), names);
+    if (!setRecords(reinterpret_cast<const uchar *>(m_data.constData()), m_data.size())) {
+        qCritical() << "failed to resolve keymap for layout" << layout;
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(m_data) != m_data.size() || !file.commit()) {
+        qWarning() << "failed to write keymap cache" << path << file.errorString();
+    }
+}
+
+Keymap::~Keymap() = default;
+
+std::optional<Keymap::Key> Keymap::lookup(xkb_keysym_t keysym) const
+{
+    const auto it = std::ranges::lower_bound(m_records, keysym, {}, &Record::keysym);
+    if (it == m_records.end() || it->keysym != keysym) {
+        return std::nullopt;
+    }
+    return Key{.keycode = it->keycode, .modifiers = std::span{it->modifiers}.first(it->modifierCount)};
+}
+
+bool Keymap::map(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const uchar *data = m_file.map(0, m_file.size());
+    if (!data || !setRecords(data, m_file.size())) {
+        qWarning() << "ignoring broken keymap cache" << path;
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+bool Keymap::setRecords(const uchar *data, qint64 size)
+{
+    Header header{};
+    if (size < qint64(sizeof(header))) {
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != formatMagic || header.version != formatVersion || size != qint64(sizeof(Header) + header.count * sizeof(Record))) {
+        return false;
+    }
+    m_records = {reinterpret_cast<const Record *>(data + sizeof(Header)), header.count};
+    return true;
+}
+
+QByteArray Keymap::build(xkb_context *context, const xkb_rule_names &names)
+{
+    Tracing::Span span("xkb", "compileKeymap");
+
+    std::unique_ptr<xkb_keymap> keymap(xkb_keymap_new_from_names(context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS));
+    if (!keymap) {
+        return {};
+    }
+    std::unique_ptr<xkb_state> state(xkb_state_new(keymap.get()));
+    const xkb_layout_index_t layout = xkb_state_serialize_layout(state.get(), XKB_STATE_LAYOUT_EFFECTIVE);
+    const xkb_mod_index_t modCount = xkb_keymap_num_mods(keymap.get());
+
+    static constexpr auto modifierKeys = {XKB_KEY_Shift_L,
+                                          XKB_KEY_Alt_L,
+                                          XKB_KEY_Meta_L,
+                                          XKB_KEY_Mode_switch,
+                                          XKB_KEY_Super_L,
+                                          XKB_KEY_Super_R,
+                                          XKB_KEY_Hyper_L,
+                                          XKB_KEY_Hyper_R,
+                                          XKB_KEY_ISO_Level3_Shift,
+                                          XKB_KEY_ISO_Level5_Shift};
+
+    struct Position {
+        xkb_keycode_t keycode;
+        xkb_level_index_t level;
+    };
+    std::map<xkb_keysym_t, Position> positions; // the lowest level a keysym is on, ordered by keysym
+    QMap<uint, QList<xkb_keycode_t>> modifierSymToCodes;
+    QMap<QString, uint> modifierNameToSym;
+
+    // Walk all levels of all keys. This finds where each keysym is, and maps modifiers to keycodes. Effectively just
+    // resolving that Alt is 123 and Ctrl is 456 etc.
+    for (const auto &keycode : std::views::iota(xkb_keymap_min_keycode(keymap.get()), xkb_keymap_max_keycode(keymap.get()) + 1)) {
+        for (const auto &level : std::views::iota(0U, xkb_keymap_num_levels_for_key(keymap.get(), keycode, layout))) {
+            const xkb_keysym_t *syms = nullptr;
+            uint num_syms = xkb_keymap_key_get_syms_by_level(keymap.get(), keycode, layout, level, &syms);
+            for (const auto &sym : std::span{syms, num_syms}) {
+                if (auto it = positions.find(sym); it == positions.end() || level <= it->second.level) {
+                    positions.insert_or_assign(sym, Position{keycode, level});
+                }
+
+                if (const auto it = std::ranges::find(modifierKeys, sym); it == modifierKeys.end()) {
+                    continue;
+                }
+
+                modifierSymToCodes[sym].push_back(keycode - EVDEV_OFFSET);
+
+                // The sym is a modifier. Find out which by pressing the key and checking which modifiers activate.
+                xkb_state_update_key(state.get(), keycode, XKB_KEY_DOWN);
+                auto up = qScopeGuard([&state, &keycode] {
+                    xkb_state_update_key(state.get(), keycode, XKB_KEY_UP);
+                });
+
+                for (const auto &mod : std::views::iota(0U, modCount)) {
+                    if (xkb_state_mod_index_is_active(state.get(), mod, XKB_STATE_MODS_EFFECTIVE) <= 0) {
+                        continue;
+                    }
+                    modifierNameToSym[QString::fromUtf8(xkb_keymap_mod_get_name(keymap.get(), mod))] = sym;
+                    break;
+                }
+            }
+        }
+    }
+
+    QByteArray data;
+    const Header header{.magic = formatMagic, .version = formatVersion, .count = quint32(positions.size())};
+    data.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &[sym, position] : positions) {
+        Record record{.keysym = sym, .keycode = position.keycode - EVDEV_OFFSET, .modifierCount = 0, .modifiers = {}};
+        // Resolve the modifiers required to produce the key, e.g. to produce 'A' we need to press the 'Shift'
+        // modifier along with the 'a' key. We need only one way to access the key, so a single mask will do.
+        std::array<xkb_mod_mask_t, 1> mask{};
+        const auto maskSize = position.level == 0
+            ? 0
+            : xkb_keymap_key_get_mods_for_level(keymap.get(), position.keycode, layout, position.level, mask.data(), mask.size());
+        for (const auto &mask : std::span{mask.data(), maskSize}) {
+            for (const auto &mod : std::views::iota(0U, modCount)) {
+                if ((mask & (1 << mod)) == 0 || record.modifierCount == maxModifiers) {
+                    continue;
+                }
+                const auto name = QString::fromUtf8(xkb_keymap_mod_get_name(keymap.get(), mod));
+                if (!modifierNameToSym.contains(name)) {
+                    continue;
+                }
+                // Using the first possible code only is a bit meh but seems to work fine so far.
+                record.modifiers.at(record.modifierCount++) = modifierSymToCodes.value(modifierNameToSym.value(name)).at(0);
+            }
+        }
+        data.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    span.setArg("keysyms", qint64(positions.size()));
+    return data;
+}
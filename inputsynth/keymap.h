@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <array>
+#include <optional>
+#include <span>
+
+#include <QByteArray>
+#include <QFile>
+
+#include <xkbcommon/xkbcommon.h>
+
+/**
+ * Tells which key, and which modifiers, produce a keysym on the layout KWin uses.
+ *
+ * Finding out means compiling the keymap and walking all levels of all keys, which takes longer than most action
+ * batches. So the result is cached as a table of fixed size records sorted by keysym in
+ * $XDG_CACHE_HOME/selenium-webdriver-at-spi/keymaps, keyed by the layout and RMLVO names and the age of the XKB data.
+ * The table is mapped straight from disk, lookups are a binary search in it.
+ */
+class Keymap
+{
+public:
+    struct Key {
+        quint32 keycode; // linux key code
+        std::span<const quint32> modifiers; // linux key codes of the modifiers to hold for it, valid as long as the Keymap
+    };
+
+    // The keymap of the current layout
+    [[nodiscard]] static const Keymap &instance();
+
+    [[nodiscard]] std::optional<Key> lookup(xkb_keysym_t keysym) const;
+
+    ~Keymap();
+    Q_DISABLE_COPY_MOVE(Keymap)
+
+private:
+    static constexpr auto maxModifiers = 4;
+
+    struct Header {
+        std::array<char, 4> magic;
+        quint32 version;
+        quint32 count;
+    };
+
+    struct Record {
+        quint32 keysym;
+        quint32 keycode;
+        quint32 modifierCount;
+        std::array<quint32, maxModifiers> modifiers;
+    };
+
+    Keymap();
+
+    // Compiles the keymap and resolves every keysym in it into the cache format
+    [[nodiscard]] static QByteArray build(xkb_context *context, const xkb_rule_names &names);
+    bool map(const QString &path);
+    bool setRecords(const uchar *data, qint64 size);
+
+    QFile m_file;
+    QByteArray m_data; // the table when it couldn't be mapped from the cache
+    std::span<const Record> m_records;
+};
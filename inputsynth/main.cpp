@@ -1,19 +1,29 @@
 // SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 // SPDX-FileCopyrightText: 2023 Harald Sitter <sitter@kde.org>
 
+#include <cstdio>
 #include <optional>
 
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QGuiApplication>
-#include <QJsonArray>
+#include <QHash>
 #include <QJsonDocument>
 #include <QJsonObject>
 
+#include "inputmethod.h"
 #include "interaction.h"
+#include "tracing.h"
 
 namespace
 {
+// The self-describe tag the driver starts its CBOR with. Anything else is taken for JSON.
+constexpr QByteArrayView cborMagic("\xd9\xd9\xf7");
+
 std::optional<wl_keyboard_key_state> typeToKeyState(QStringView type)
 {
     if (type == QLatin1String("keyDown")) {
@@ -25,128 +35,266 @@ std::optional<wl_keyboard_key_state> typeToKeyState(QStringView type)
     qWarning() << "unsupported keyboard action type" << type;
     return {};
 }
-} // namespace
 
-int main(int argc, char **argv)
+// Numbers may come as integers or doubles, depending on who produced them
+qint64 toInteger(const QCborValue &value)
 {
-    QGuiApplication app(argc, argv);
+    return value.isDouble() ? qRound64(value.toDouble()) : value.toInteger();
+}
 
-    const auto actionFilePath = qGuiApp->arguments().at(1);
-    QFile actionFile(actionFilePath);
-    if (!actionFile.open(QFile::ReadOnly)) {
-        qWarning() << "failed to open action file" << actionFilePath;
-        return 1;
+std::optional<QCborMap> readActionFile(const QString &path)
+{
+    Tracing::Span span("input", "readActions");
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        qWarning() << "failed to open action file" << path;
+        return {};
+    }
+    const QByteArray data = file.readAll();
+    if (data.startsWith(cborMagic)) {
+        QCborParserError error;
+        const auto value = QCborValue::fromCbor(data, &error);
+        if (error.error != QCborError::NoError) {
+            qWarning() << "failed to parse action file" << error.errorString();
+            return {};
+        }
+        return value.taggedValue().toMap();
+    }
+    QJsonParseError error;
+    const auto document = QJsonDocument::fromJson(data, &error);
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "failed to parse action file" << error.errorString();
+        return {};
     }
+    return QCborMap::fromJsonObject(document.object());
+}
 
-    std::vector<BaseAction *> actions;
+void parseKeyActions(const QCborArray &keyActions, std::vector<Action> &actions)
+{
+    for (const auto &keyAction : keyActions) {
+        const auto map = keyAction.toMap();
+        const auto type = map.value(QLatin1String("type")).toString();
+        if (type == QLatin1String("pause")) {
+            actions.emplace_back(std::in_place_type<PauseAction>, toInteger(map.value(QLatin1String("duration"))));
+        } else if (type == QLatin1String("text")) {
+            // Not a WebDriver action, our own for typing whole strings
+            actions.emplace_back(std::in_place_type<TextAction>, map.value(QLatin1String("value")).toString());
+        } else {
+            const auto string = map.value(QLatin1String("value")).toString();
+            if (string.isEmpty()) {
+                qWarning() << "ignoring key action without a key" << type;
+                continue;
+            }
+            actions.emplace_back(std::in_place_type<KeyboardAction>, string.at(0), typeToKeyState(type).value_or(WL_KEYBOARD_KEY_STATE_RELEASED));
+        }
+    }
+}
 
-    s_interface = new FakeInputInterface;
+void parsePointerActions(const QCborMap &actionSet, std::vector<Action> &actions)
+{
+    /*
+      https://github.com/SeleniumHQ/selenium/blob/6620bce4e8e9da1fee3ec5a5547afa7dece3f80e/py/selenium/webdriver/common/actions/pointer_input.py#L66
+        def encode(self):
+            return {"type": self.type, "parameters": {"pointerType": self.kind}, "id": self.name, "actions": self.actions}
+     */
+    const QString id = actionSet.value(QLatin1String("id")).toString(QStringLiteral("Default"));
 
-    const auto document = QJsonDocument::fromJson(actionFile.readAll());
-    const auto jsonObject = document.object();
-    const auto jsonActions = jsonObject.value(QStringLiteral("actions")).toArray();
-    for (const auto &jsonActionSet : jsonActions) {
-        if (auto inputType = jsonActionSet[QLatin1String("type")]; inputType == QLatin1String("key")) {
-            for (const auto &jsonAction : jsonActionSet[QStringLiteral("actions")].toArray()) {
-                const auto hash = jsonAction.toObject().toVariantHash();
-                const auto type = hash.value(QStringLiteral("type")).toString();
-                BaseAction *action = nullptr;
-
-                if (type == QLatin1String("pause")) {
-                    const ulong duration = hash.value(QStringLiteral("duration")).value<ulong>();
-                    action = new PauseAction(duration);
-                } else {
-                    const auto string = hash.value(QStringLiteral("value")).toString();
-                    const QChar *character = string.unicode();
-                    action = new KeyboardAction(*character, typeToKeyState(type).value_or(WL_KEYBOARD_KEY_STATE_RELEASED));
-                }
-
-                actions.emplace_back(action);
-            }
-        } else if (inputType == QLatin1String("pointer")) {
-            /*
-              https://github.com/SeleniumHQ/selenium/blob/6620bce4e8e9da1fee3ec5a5547afa7dece3f80e/py/selenium/webdriver/common/actions/pointer_input.py#L66
-                def encode(self):
-                    return {"type": self.type, "parameters": {"pointerType": self.kind}, "id": self.name, "actions": self.actions}
-             */
-            const QString id = jsonActionSet[QLatin1String("id")].toString(QStringLiteral("Default"));
-
-            PointerAction::PointerKind pointerTypeInt = PointerAction::PointerKind::Mouse;
-            if (const QString pointerType = jsonActionSet[QLatin1String("parameters")].toObject().toVariantHash()[QStringLiteral("pointerType")].toString();
-                pointerType == QLatin1String("touch")) {
-                pointerTypeInt = PointerAction::PointerKind::Touch;
-            } else if (pointerType == QLatin1String("pen")) {
-                pointerTypeInt = PointerAction::PointerKind::Pen;
-            }
+    PointerAction::PointerKind pointerTypeInt = PointerAction::PointerKind::Mouse;
+    if (const QString pointerType = actionSet.value(QLatin1String("parameters")).toMap().value(QLatin1String("pointerType")).toString();
+        pointerType == QLatin1String("touch")) {
+        pointerTypeInt = PointerAction::PointerKind::Touch;
+    } else if (pointerType == QLatin1String("pen")) {
+        pointerTypeInt = PointerAction::PointerKind::Pen;
+    }
+
+    for (const auto &pointerAction : actionSet.value(QLatin1String("actions")).toArray()) {
+        const auto map = pointerAction.toMap();
+        const auto duration = toInteger(map.value(QLatin1String("duration")));
+
+        PointerAction::ActionType actionTypeInt = PointerAction::ActionType::Cancel;
+        if (const QString actionType = map.value(QLatin1String("type")).toString(); actionType == QLatin1String("pointerDown")) {
+            actionTypeInt = PointerAction::ActionType::Down;
+        } else if (actionType == QLatin1String("pointerUp")) {
+            actionTypeInt = PointerAction::ActionType::Up;
+        } else if (actionType == QLatin1String("pointerMove")) {
+            actionTypeInt = PointerAction::ActionType::Move;
+        } else if (actionType == QLatin1String("pause")) {
+            actions.emplace_back(std::in_place_type<PauseAction>, duration);
+            continue;
+        }
+
+        PointerAction::Button button = PointerAction::Button::Left;
+        if (pointerTypeInt == PointerAction::PointerKind::Mouse) {
+            button = static_cast<PointerAction::Button>(toInteger(map.value(QLatin1String("button"))));
+        }
+
+        auto &action = std::get<PointerAction>(actions.emplace_back(std::in_place_type<PointerAction>, pointerTypeInt, id, actionTypeInt, button, duration));
 
-            const auto pointerActions = jsonActionSet[QLatin1String("actions")].toArray();
-            for (const auto &pointerAction : pointerActions) {
-                const auto hash = pointerAction.toObject().toVariantHash();
-                const auto duration = hash.value(QStringLiteral("duration")).value<ulong>();
-
-                PointerAction::ActionType actionTypeInt = PointerAction::ActionType::Cancel;
-                if (const QString actionType = hash.value(QStringLiteral("type")).toString(); actionType == QLatin1String("pointerDown")) {
-                    actionTypeInt = PointerAction::ActionType::Down;
-                } else if (actionType == QLatin1String("pointerUp")) {
-                    actionTypeInt = PointerAction::ActionType::Up;
-                } else if (actionType == QLatin1String("pointerMove")) {
-                    actionTypeInt = PointerAction::ActionType::Move;
-                } else if (actionType == QLatin1String("pause")) {
-                    actions.emplace_back(new PauseAction(duration));
-                    continue;
-                }
-
-                PointerAction::Button button = PointerAction::Button::Left;
-                if (pointerTypeInt == PointerAction::PointerKind::Mouse) {
-                    button = static_cast<PointerAction::Button>(hash.value(QStringLiteral("button")).toInt());
-                }
-
-                auto action = new PointerAction(pointerTypeInt, id, actionTypeInt, button, duration);
-
-                if (actionTypeInt == PointerAction::ActionType::Move) {
-                    // Positions relative to elements are ignored since at-spi2 can't report correct element positions.
-                    PointerAction::Origin originInt = PointerAction::Origin::Viewport;
-                    if (hash.value(QStringLiteral("origin")).toString() == QLatin1String("pointer")) {
-                        originInt = PointerAction::Origin::Pointer;
-                    }
-
-                    const int x = hash.value(QStringLiteral("x")).toInt();
-                    const int y = hash.value(QStringLiteral("y")).toInt();
-                    action->setPosition({x, y}, originInt);
-                }
-
-                actions.emplace_back(action);
+        if (actionTypeInt == PointerAction::ActionType::Move) {
+            // Positions relative to elements are ignored since at-spi2 can't report correct element positions.
+            PointerAction::Origin originInt = PointerAction::Origin::Viewport;
+            if (map.value(QLatin1String("origin")).toString() == QLatin1String("pointer")) {
+                originInt = PointerAction::Origin::Pointer;
             }
+
+            const int x = int(toInteger(map.value(QLatin1String("x"))));
+            const int y = int(toInteger(map.value(QLatin1String("y"))));
+            action.setPosition({x, y}, originInt);
+        }
+    }
+}
+
+void parseWheelActions(const QCborMap &actionSet, std::vector<Action> &actions)
+{
+    const QString id = actionSet.value(QLatin1String("id")).toString(QStringLiteral("Default"));
+    for (const auto &wheelAction : actionSet.value(QLatin1String("actions")).toArray()) {
+        const auto map = wheelAction.toMap();
+        const auto duration = toInteger(map.value(QLatin1String("duration")));
+
+        if (map.value(QLatin1String("type")).toString() == QLatin1String("pause")) {
+            actions.emplace_back(std::in_place_type<PauseAction>, duration);
             continue;
+        }
+        const QPoint pos(int(toInteger(map.value(QLatin1String("x")))), int(toInteger(map.value(QLatin1String("y")))));
+        const QPoint delta(int(toInteger(map.value(QLatin1String("deltaX")))), int(toInteger(map.value(QLatin1String("deltaY")))));
+        actions.emplace_back(std::in_place_type<WheelAction>, id, pos, delta, duration);
+    }
+}
+
+// Our own action set type, e.g. {"type": "gesture", "actions": [{"type": "pinch", "x": 500, "y": 400, "startSpan": 100,
+// "endSpan": 400, "duration": 500}]}
+void parseGestureActions(const QCborArray &gestureActions, std::vector<Action> &actions)
+{
+    static const QHash<QString, GestureAction::Kind> kinds{
+        {QStringLiteral("pinch"), GestureAction::Kind::Pinch},
+        {QStringLiteral("rotate"), GestureAction::Kind::Rotate},
+        {QStringLiteral("swipe"), GestureAction::Kind::Swipe},
+        {QStringLiteral("fling"), GestureAction::Kind::Fling},
+    };
+
+    for (const auto &gestureAction : gestureActions) {
+        const auto map = gestureAction.toMap();
+        const auto type = map.value(QLatin1String("type")).toString();
+        if (type == QLatin1String("pause")) {
+            actions.emplace_back(std::in_place_type<PauseAction>, toInteger(map.value(QLatin1String("duration"))));
+            continue;
+        }
+        const auto kind = kinds.constFind(type);
+        if (kind == kinds.cend()) {
+            qWarning() << "unsupported gesture" << type;
+            continue;
+        }
+
+        GestureAction::Parameters parameters;
+        auto number = [&map](QLatin1String key, double fallback) {
+            return map.value(key).toDouble(fallback);
+        };
+        parameters.center = {number(QLatin1String("x"), 0), number(QLatin1String("y"), 0)};
+        parameters.startSpan = number(QLatin1String("startSpan"), parameters.startSpan);
+        parameters.endSpan = number(QLatin1String("endSpan"), parameters.startSpan);
+        parameters.startAngle = number(QLatin1String("startAngle"), parameters.startAngle);
+        parameters.angle = number(QLatin1String("angle"), parameters.angle);
+        parameters.fingers = int(number(QLatin1String("fingers"), parameters.fingers));
+        parameters.spacing = number(QLatin1String("spacing"), parameters.spacing);
+        parameters.delta = {number(QLatin1String("deltaX"), 0), number(QLatin1String("deltaY"), 0)};
+        parameters.velocity = {number(QLatin1String("velocityX"), 0), number(QLatin1String("velocityY"), 0)};
+        if (*kind == GestureAction::Kind::Fling) {
+            // A fling is over quickly, it's the speed at which the fingers lift that matters
+            parameters.duration = 100;
+        }
+        parameters.duration = static_cast<unsigned long>(number(QLatin1String("duration"), parameters.duration));
+        parameters.rate = int(number(QLatin1String("rate"), parameters.rate));
+        actions.emplace_back(std::in_place_type<GestureAction>, *kind, parameters);
+    }
+}
+
+std::vector<Action> parseActions(const QCborMap &document)
+{
+    Tracing::Span span("input", "parseActions");
+    const auto actionSets = document.value(QLatin1String("actions")).toArray();
+
+    std::vector<Action> actions;
+    qsizetype count = 0;
+    for (const auto &actionSet : actionSets) {
+        count += actionSet.toMap().value(QLatin1String("actions")).toArray().size();
+    }
+    actions.reserve(count);
+
+    for (const auto &actionSetValue : actionSets) {
+        const auto actionSet = actionSetValue.toMap();
+        if (auto inputType = actionSet.value(QLatin1String("type")).toString(); inputType == QLatin1String("key")) {
+            parseKeyActions(actionSet.value(QLatin1String("actions")).toArray(), actions);
+        } else if (inputType == QLatin1String("pointer")) {
+            parsePointerActions(actionSet, actions);
         } else if (inputType == QLatin1String("wheel")) {
-            const QString id = jsonActionSet[QLatin1String("id")].toString(QStringLiteral("Default"));
-            const auto wheelActions = jsonActionSet[QLatin1String("actions")].toArray();
-            for (const auto &pointerAction : wheelActions) {
-                const auto hash = pointerAction.toObject().toVariantHash();
-                const auto duration = hash.value(QStringLiteral("duration")).value<ulong>();
-
-                if (const QString actionType = hash.value(QStringLiteral("type")).toString(); actionType == QLatin1String("pause")) {
-                    actions.emplace_back(new PauseAction(duration));
-                    continue;
-                } else {
-                    const auto x = hash.value(QStringLiteral("x")).toInt();
-                    const auto y = hash.value(QStringLiteral("y")).toInt();
-                    const auto deltaX = hash.value(QStringLiteral("deltaX")).toInt();
-                    const auto deltaY = hash.value(QStringLiteral("deltaY")).toInt();
-                    actions.emplace_back(new WheelAction(id, QPoint(x, y), QPoint(deltaX, deltaY), duration));
-                }
-            }
+            parseWheelActions(actionSet, actions);
+        } else if (inputType == QLatin1String("gesture")) {
+            parseGestureActions(actionSet.value(QLatin1String("actions")).toArray(), actions);
         } else {
-            qWarning() << "unsupported action type" << jsonActionSet;
-            continue;
+            qWarning() << "unsupported action type" << actionSetValue;
         }
     }
+    span.setArg("actions", qint64(actions.size()));
+    return actions;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    QGuiApplication app(argc, argv);
+
+    // --input-method runs as the compositor's input method until it gets quit, see inputmethod.h.
+    // --parse-only reads the actions, prints how long that took and quits. For benchmarking.
+    // --timestamps prints "performed <microseconds>" on CLOCK_MONOTONIC once the compositor has processed an action,
+    // for the frame watcher to measure how long the application takes to react.
+    QStringList arguments = qGuiApp->arguments();
+    const bool parseOnly = arguments.removeAll(QStringLiteral("--parse-only")) > 0;
+    const bool timestamps = arguments.removeAll(QStringLiteral("--timestamps")) > 0;
 
-    auto performActions = [actions = std::move(actions)] {
-        for (auto action : actions) {
-            action->perform();
+    if (arguments.contains(QStringLiteral("--input-method"))) {
+        InputMethod inputMethod;
+        if (!inputMethod.isActive()) {
+            qWarning() << "the compositor did not offer zwp_input_method_v1";
+            return 1;
+        }
+        if (!inputMethod.registerService()) {
+            return 1;
+        }
+        return app.exec();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const auto document = readActionFile(arguments.at(1));
+    if (!document) {
+        return 1;
+    }
+    auto actions = parseActions(*document);
+    if (parseOnly) {
+        printf("%zu actions in %lld us\n", actions.size(), timer.nsecsElapsed() / 1000);
+        return 0;
+    }
+
+    s_interface = new FakeInputInterface;
+
+    auto performActions = [actions = std::move(actions), timestamps]() mutable {
+        Tracing::Span span("input", "performActions");
+        span.setArg("actions", qint64(actions.size()));
+        for (auto &action : actions) {
+            if (!std::holds_alternative<KeyboardAction>(action)) {
+                s_interface->releaseKeyModifiers();
+            }
+            std::visit(
+                [](auto &action) {
+                    action.perform();
+                },
+                action);
+            if (timestamps) {
+                printf("performed %lld\n", Tracing::now());
+            }
         }
-        qDeleteAll(actions);
+        s_interface->releaseKeyModifiers();
+        fflush(stdout);
         QCoreApplication::quit();
     };
 
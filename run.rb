@@ -4,18 +4,30 @@
 # SPDX-License-Identifier: AGPL-3.0-or-later
 # SPDX-FileCopyrightText: 2022-2023 Harald Sitter <sitter@kde.org>
 
+require 'etc'
 require 'fileutils'
+require 'io/wait'
+require 'json'
 require 'logger'
+require 'net/http'
 require 'shellwords'
+require 'socket'
 require 'tmpdir'
 
 SYSTEMD_ASSISTED_CI = ENV['KDECI_BUILD'] == 'TRUE' && !ENV['KDECI_PLATFORM_PATH'].include?('alpine')
 # APPIUM_ARTIFACT_OUTPUT_PATH environment variable allows setting an arbitrary
 # directory for artifact files, rather than the working directory
 ARTIFACT_OUTPUT_DIR = File.expand_path(ENV.fetch('APPIUM_ARTIFACT_OUTPUT_PATH', '.')).freeze
+# Set on the worker processes of a sharded run (see ShardRunner). Each shard is a fully isolated environment running
+# a list of tests one after another.
+SHARD_NAME = ENV['SELENIUM_SHARD_NAME']
+# `selenium-webdriver-at-spi-run --shards N|auto test1 test2 ...` spreads the tests across N shards (see ShardRunner).
+# `--pool N|auto` does the same but hands out the tests one at a time to whichever shard is free.
+SHARDED = %w[--shards --pool].include?(ARGV[0])
 
 def at_bus_exists?
-  return true if SYSTEMD_ASSISTED_CI # when managed by systemd it may be lazily started
+  # when managed by systemd it may be lazily started (shards always bring their own though)
+  return true if SYSTEMD_ASSISTED_CI && !ENV.include?('CUSTOM_BUS')
 
   IO.popen(['dbus-send', '--print-reply=literal', '--dest=org.freedesktop.DBus', '/org/freedesktop/DBus', 'org.freedesktop.DBus.ListNames'], 'r') do |io|
     io.read.include?('org.a11y.Bus')
@@ -46,6 +58,32 @@ def terminate_pids(pids)
   end
 end
 
+# Prefix for the artifacts of this run. Usually the test file, for shards the name of the shard.
+def artifact_name
+  return SHARD_NAME if SHARD_NAME
+  return 'shards' if SHARDED
+
+  File.basename(ARGV[0])
+end
+
+def monotonic_now
+  Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+# Waits for io to produce a line matching the block, for at most timeout seconds. Returns the line or nil on
+# timeout/EOF. Used for readiness handshakes so we continue the moment something is up rather than polling it.
+def wait_for_line(io, timeout:)
+  deadline = monotonic_now + timeout
+  while (remaining = deadline - monotonic_now).positive?
+    return nil unless io.wait_readable(remaining)
+
+    line = io.gets
+    return nil unless line
+    return line if yield(line)
+  end
+  nil
+end
+
 def artifact_path(filename)
   FileUtils.mkdir_p(ARTIFACT_OUTPUT_DIR)
   File.join(ARTIFACT_OUTPUT_DIR, filename)
@@ -103,7 +141,10 @@ def kwin_reexec!
   # As such this function has two behavior modes. If kwin redirection should run (that is: it's not yet inside kwin)
   # it will fork and exec into kwin. If redirection is not required it yields out.
 
-  return if ENV.include?('KWIN_PID') # already inside a kwin parent
+  if ENV.include?('KWIN_PID') # already inside a kwin parent
+    enable_input_method!
+    return
+  end
   return if ENV['TEST_WITH_KWIN_WAYLAND'] == '0'
 
   kwin_pid = fork do |pid|
@@ -122,20 +163,31 @@ def kwin_reexec!
     extra_args << '--virtual' if ENV['LIBGL_ALWAYS_SOFTWARE']
     extra_args << '--xwayland' if ENV.fetch('TEST_WITH_XWAYLAND', '0').to_i.positive?
     extra_args << '--no-global-shortcuts' if ENV.fetch('TEST_WITHOUT_GLOBAL_SHORTCUTS', '1').to_i.positive?
+    extra_args << "--socket=wayland-selenium-#{SHARD_NAME}" if SHARD_NAME
+    # The inputsynth doubles as input method, so typed text can be committed as a whole (see inputsynth/inputmethod.h)
+    extra_args << '--inputmethod' << 'selenium-webdriver-at-spi-inputsynth --input-method'
     # A bit awkward because of how argument parsing works on the kwin side: we must rely on shell word merging for
     # the __FILE__ ARGV bit, separate ARGVs to kwin_wayland would be distinct subprocesses to start but we want
     # one processes with a bunch of arguments.
     exec('kwin_wayland', '--no-lockscreen', *extra_args,
-         '--exit-with-session', "#{__FILE__} #{ARGV.shelljoin}", out: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_kwin_stdout.log"))
+         '--exit-with-session', "#{__FILE__} #{ARGV.shelljoin}", out: artifact_path("appium_artifact_#{artifact_name}_kwin_stdout.log"))
   end
   _pid, status = Process.waitpid2(kwin_pid)
   status.success? ? exit : abort
 end
 
+def enable_input_method!
+  # KWin only starts its input method while the virtual keyboard is enabled. Typing works without it, so failing to
+  # enable it is not fatal.
+  system('dbus-send', '--print-reply', '--dest=org.kde.KWin', '/VirtualKeyboard', 'org.freedesktop.DBus.Properties.Set',
+         'string:org.kde.kwin.VirtualKeyboard', 'string:enabled', 'variant:boolean:true', out: File::NULL, err: File::NULL) ||
+    warn('failed to enable the input method')
+end
+
 def dbus_reexec!(logger:)
   return if ENV.include?('CUSTOM_BUS') # already inside a nested bus
 
-  if SYSTEMD_ASSISTED_CI
+  if SYSTEMD_ASSISTED_CI && !SHARD_NAME
     if ENV.fetch('USE_CUSTOM_BUS', '0').to_i != 0
       logger.info('running in systemd assisted CI, relying on systemd user services. Ignoring USE_CUSTOM_BUS')
     end
@@ -158,7 +210,7 @@ def dbus_reexec!(logger:)
   _pid, status = Process.waitpid2(pid)
   terminate_pgids([pgid])
   logger.info('dbus session ended')
-  system('ps fja', out: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_ps_stdout.log"))
+  system('ps fja', out: artifact_path("appium_artifact_#{artifact_name}_ps_stdout.log"))
   status.success? ? exit : abort
 end
 
@@ -170,9 +222,9 @@ class Recorder
 
     pids = []
     if ENV['KWIN_PID'] # Only auto-record if using kwin_wayland
-      if ARGV.size >= 1
+      if SHARD_NAME || ARGV.size >= 1
         # There is at least one argument, it should be the file name of the test to run. Let's just record as that.
-        ENV['RECORD_VIDEO_NAME'] = artifact_path("appium_artifact_#{File.basename(ARGV[0])}.webm")
+        ENV['RECORD_VIDEO_NAME'] = artifact_path("appium_artifact_#{artifact_name}.webm")
       elsif ARGV.include?('--selenium-record-video')
         # Extract our own argument and the argument that follows it, then delete them so they don't mess with the
         # actual test.
@@ -199,22 +251,23 @@ class Recorder
       pids << spawn('wireplumber')
     end
 
-    20.times do # make sure pipewire is up and kwin is connected already, otherwise recording will definitely fail
-      break if system('pw-dump | grep -q kwin_wayland')
-
-      sleep(1)
+    # make sure pipewire is up and kwin is connected already, otherwise recording will definitely fail
+    # pw-dump in monitor mode dumps the current graph and then every change, so we see kwin the moment it connects.
+    IO.popen(%w[pw-dump --monitor], 'r', err: File::NULL) do |io|
+      warn 'kwin_wayland did not show up on pipewire' unless wait_for_line(io, timeout: 20) { |line| line.include?('kwin_wayland') }
+    ensure
+      Process.kill('TERM', io.pid)
     end
 
-    pids << spawn('selenium-webdriver-at-spi-recorder', '--output', recording)
-
-    20.times do
-      break if File.exist?(start_marker)
-
-      sleep(1)
-    end
+    # The recorder signals us with SIGUSR1 once it is recording. Self-pipe so we can wait on it with a timeout.
+    started_reader, started_writer = IO.pipe
+    previous_handler = trap('USR1') { started_writer.write_nonblock('.', exception: false) }
+    pids << spawn('selenium-webdriver-at-spi-recorder', '--output', recording, '--notify-pid', Process.pid.to_s)
+    started = started_reader.wait_readable(20)
+    trap('USR1', previous_handler)
 
-    unless File.exist?(start_marker)
-      warn "Video recording didn't start properly, file was not created #{start_marker}"
+    unless started
+      warn "Video recording didn't start properly, no signal within time limit #{start_marker}"
       abort "Failed to start video recording. Please talk to sitter!"
     end
 
@@ -242,14 +295,22 @@ end
 class Driver
   def self.with(datadir, &block)
     pids = []
-    env = { 'FLASK_ENV' => 'production', 'FLASK_APP' => 'selenium-webdriver-at-spi.py' }
+    # The driver writes a line to the inherited fd once it is listening, so we know exactly when it is up.
+    ready_reader, ready_writer = IO.pipe
+    env = { 'FLASK_ENV' => 'production', 'SELENIUM_READY_FD' => ready_writer.fileno.to_s }
     env['GDK_BACKEND'] = 'wayland' if ENV['KWIN_PID']
     pids << spawn(env,
-                  'flask', 'run', '--port', PORT, '--no-reload',
+                  'python3', 'selenium-webdriver-at-spi.py', '--port', PORT,
                   chdir: datadir,
-                  out: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_webdriver_stdout.log"))
+                  ready_writer => ready_writer,
+                  out: artifact_path("appium_artifact_#{artifact_name}_webdriver_stdout.log"))
+    ready_writer.close
+    # EOF means the driver died on us before it got anywhere
+    raise 'Driver failed to start' unless wait_for_line(ready_reader, timeout: 15) { |line| line.start_with?('ready') }
+
     block.yield
   ensure
+    ready_reader&.close
     terminate_pids(pids)
   end
 end
@@ -258,6 +319,8 @@ end
 # the existing home is used as-is. Otherwise a throw-away XDG home is created so the test
 # starts with a clean slate with every run, and doesn't mess with your local installation.
 class CleanHome
+  DRIVER_CACHE_NAME = 'selenium-webdriver-at-spi'
+
   def self.with(&block)
     return block.yield if ENV['TEST_WITH_CLEAN_HOME'] == '0'
 
@@ -269,9 +332,265 @@ class CleanHome
       block.yield
     end
   end
+
+  # Wipes the throw-away home so the next test of a shard starts from a clean slate again. The directories themselves
+  # stay, everything running in the environment already knows their paths. The driver's own cache is kept, it holds
+  # nothing the application under test could see and the driver keeps it from growing beyond a fixed size.
+  def self.reset!
+    return if ENV['TEST_WITH_CLEAN_HOME'] == '0'
+
+    %w[CACHE CONFIG DATA STATE].each do |d|
+      dir = ENV.fetch("XDG_#{d}_HOME")
+      Dir.children(dir).each do |child|
+        next if d == 'CACHE' && child == DRIVER_CACHE_NAME
+
+        FileUtils.rm_rf(File.join(dir, child))
+      end
+    end
+  end
+end
+
+# Runs a list of test files across N isolated environments at the same time. Every shard is a worker instance of this
+# script with its own session bus, a11y bus, nested KWin, XDG dirs and driver port. The stack of a shard is started
+# once and stays warm for all its tests, between tests the shard only resets itself (see reset_shard).
+# Tests are ordered longest first, based on the durations of the previous sharded run if there is one. By default
+# they are distributed ahead of time. In pool mode the shards instead ask for the next test over a unix socket
+# whenever they are free, which balances better when durations are unknown or vary.
+# Once all shards are done their artifacts and results are merged into the artifact dir.
+# NB: tests need to talk to the driver on FLASK_PORT rather than the default port for this to work.
+class ShardRunner
+  RESULTS_FILE = 'appium_artifact_shards_results.json'
+
+  def initialize(count:, tests:, logger:, pool: false)
+    @tests = tests.map { |test| File.expand_path(test) }
+    @count = count.clamp(1, @tests.size)
+    @logger = logger
+    @pool = pool
+  end
+
+  def run
+    base_port = Integer(PORT)
+    workers = nil
+    serve_pool do |socket_path|
+      workers = distribute.each_with_index.map do |tests, index|
+        spawn_worker("shard-#{index}", tests, base_port + index, socket_path)
+      end
+      wait(workers)
+    end
+    merge(workers)
+  end
+
+  private
+
+  # Hands out tests to whichever shard asks. The protocol is line based: a shard connects and says its name, we reply
+  # with a test or an empty line when there is nothing left to do, the shard says 'next' once it is ready again.
+  def serve_pool
+    return yield nil unless @pool
+
+    queue = Queue.new
+    ordered_tests.each { |test| queue << test }
+    Dir.mktmpdir('selenium-pool') do |dir|
+      server = UNIXServer.new(File.join(dir, 'socket'))
+      acceptor = Thread.new do
+        loop do
+          Thread.new(server.accept) do |socket|
+            name = socket.gets&.chomp
+            loop do
+              test = queue.empty? ? nil : queue.pop(true)
+              socket.puts(test.to_s)
+              break unless test
+
+              @logger.info "#{name} takes #{test}"
+              break unless socket.gets
+            end
+          rescue ThreadError, SystemCallError, IOError
+            # queue drained by another shard in the meantime, or the shard went away
+          ensure
+            socket.close
+          end
+        end
+      rescue IOError, SystemCallError
+        # server closed, all shards are done
+      end
+      yield server.path
+    ensure
+      server&.close
+      acceptor&.join
+    end
+  end
+
+  def wait(workers)
+    workers.each do |worker|
+      _pid, worker[:status] = Process.waitpid2(worker[:pid])
+      @logger.info "#{worker[:name]} done #{worker[:status]}"
+      begin
+        Process.kill('-TERM', worker[:pid]) # the worker's process group, in case something dangles
+      rescue Errno::ESRCH
+        # group already dead, nothing to do
+      end
+    end
+  end
+
+  def previous_durations
+    path = artifact_path(RESULTS_FILE)
+    return {} unless File.exist?(path)
+
+    JSON.parse(File.read(path)).to_h { |result| [result['test'], result['duration'].to_f] }
+  rescue JSON::ParserError
+    {}
+  end
+
+  def durations
+    @durations ||= previous_durations
+  end
+
+  def duration(test)
+    fallback = durations.empty? ? 1.0 : durations.values.sum / durations.size
+    durations.fetch(test, fallback)
+  end
+
+  def ordered_tests
+    @tests.each_with_index.sort_by { |test, index| [-duration(test), index] }.map(&:first)
+  end
+
+  # Longest processing time first: hand the next longest test to the least loaded shard.
+  # In pool mode the shards pick up their tests at runtime, they only need to exist.
+  def distribute
+    return Array.new(@count) { [] } if @pool
+
+    shards = Array.new(@count) { { tests: [], load: 0.0 } }
+    ordered_tests.each do |test|
+      shard = shards.min_by { |candidate| candidate[:load] }
+      shard[:tests] << test
+      shard[:load] += duration(test)
+    end
+    shards.map { |shard| shard[:tests] }.reject(&:empty?)
+  end
+
+  def spawn_worker(name, tests, port, pool_socket)
+    dir = File.join(ARTIFACT_OUTPUT_DIR, name)
+    FileUtils.rm_rf(dir)
+    runtime_dir = Dir.mktmpdir("selenium-#{name}-runtime")
+    env = {
+      'SELENIUM_SHARD_NAME' => name,
+      'SELENIUM_SHARD_TESTS' => tests.shelljoin,
+      'SELENIUM_POOL_SOCKET' => pool_socket,
+      'SELENIUM_REQUIREMENTS_INSTALLED' => '1',
+      'APPIUM_ARTIFACT_OUTPUT_PATH' => dir,
+      'FLASK_PORT' => port.to_s,
+      # A private bus and runtime dir give every shard its own at-spi bus, wayland socket and pipewire instance
+      'USE_CUSTOM_BUS' => '1',
+      'XDG_RUNTIME_DIR' => runtime_dir
+    }
+    # Make sure a relative WAYLAND_DISPLAY of the host session still resolves with the private runtime dir.
+    display = ENV.fetch('WAYLAND_DISPLAY', '')
+    if !display.empty? && !display.start_with?('/') && ENV['XDG_RUNTIME_DIR']
+      env['WAYLAND_DISPLAY'] = File.join(ENV.fetch('XDG_RUNTIME_DIR'), display)
+    end
+    pid = spawn(env, __FILE__, pgroup: true, out: artifact_path("appium_artifact_#{name}_stdout.log"), err: %i[child out])
+    @logger.info "started #{name} (pid #{pid}, port #{port})#{" with #{tests.size} tests" unless @pool}"
+    { name: name, pid: pid, dir: dir, runtime_dir: runtime_dir, tests: tests }
+  end
+
+  def merge(workers)
+    results = workers.flat_map do |worker|
+      results_path = File.join(worker[:dir], "appium_artifact_#{worker[:name]}_results.jsonl")
+      reported = File.exist?(results_path) ? File.readlines(results_path).map { |line| JSON.parse(line) } : []
+      # A shard that fell over midway never reports its remaining tests, count them as failed.
+      missing = (@pool ? [] : worker[:tests]) - reported.map { |result| result['test'] }
+      reported + missing.map { |test| { 'test' => test, 'shard' => worker[:name], 'success' => false, 'duration' => 0 } }
+    ensure
+      Dir.children(worker[:dir]).each { |file| FileUtils.mv(File.join(worker[:dir], file), artifact_path(file)) } if File.directory?(worker[:dir])
+      FileUtils.rm_rf(worker[:dir])
+      FileUtils.rm_rf(worker[:runtime_dir])
+    end
+    # In pool mode a shard dying takes the test it was running down with it, everything else is picked up by the others.
+    results += (@tests - results.map { |result| result['test'] }).map do |test|
+      { 'test' => test, 'shard' => nil, 'success' => false, 'duration' => 0 }
+    end
+    File.write(artifact_path(RESULTS_FILE), JSON.pretty_generate(results))
+
+    results.each do |result|
+      @logger.info format('%<state>-4s %<duration>7.1fs %<shard>s %<test>s', state: result['success'] ? 'PASS' : 'FAIL',
+                                                                             duration: result['duration'],
+                                                                             shard: result['shard'],
+                                                                             test: result['test'])
+    end
+    resets = results.filter_map { |result| result['reset'] }.sort
+    unless resets.empty?
+      @logger.info format('reset latency: mean %<mean>.3fs median %<median>.3fs max %<max>.3fs over %<count>d resets',
+                          mean: resets.sum / resets.size, median: resets[resets.size / 2], max: resets.last,
+                          count: resets.size)
+    end
+    results.all? { |result| result['success'] } && workers.all? { |worker| worker[:status].success? }
+  end
+end
+
+def run_test(argv, logger, **redirects)
+  logger.info "starting test #{argv}"
+  ret = begin
+    system(*argv, exception: true, pgroup: true, **redirects)
+  rescue RuntimeError # We intentionally let ENOENT raise out of this block
+    false
+  end
+  begin
+    # terminate the whole process group to try and make sure we also kill subprocesses of the test it hadn't cleaned up
+    test_proc = $?
+    Process.kill('TERM', -test_proc.pid)
+  rescue Errno::ESRCH
+    # group already dead, nothing to do
+  end
+  ret
+end
+
+# The tests of this shard. Either a fixed list or, in pool mode, whatever the ShardRunner hands us next.
+def shard_tests
+  return Shellwords.split(ENV.fetch('SELENIUM_SHARD_TESTS')).each if ENV.fetch('SELENIUM_POOL_SOCKET', '').empty?
+
+  Enumerator.new do |yielder|
+    UNIXSocket.open(ENV.fetch('SELENIUM_POOL_SOCKET')) do |socket|
+      socket.puts(SHARD_NAME)
+      while (test = socket.gets&.chomp) && !test.empty?
+        yielder << test
+        socket.puts('next')
+      end
+    end
+  end
+end
+
+# Cheap reset between two tests of a shard so the warm stack can be reused: closes all driver sessions (which kills
+# the apps they launched) and wipes the clean home. The test's own process group is already gone by now.
+def reset_shard
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  Net::HTTP.start('localhost', PORT) { |http| http.delete('/session') }
+  CleanHome.reset!
+  Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+end
+
+# Runs the tests of a shard one after another and records a result line for each.
+def run_shard_tests(logger)
+  results_path = artifact_path("appium_artifact_#{SHARD_NAME}_results.jsonl")
+  shard_tests.each_with_index.map do |test, index|
+    reset = reset_shard unless index.zero?
+    started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    success = begin
+      run_test([test], logger, out: artifact_path("appium_artifact_#{File.basename(test)}_stdout.log"), err: %i[child out])
+    rescue SystemCallError => e
+      logger.error "failed to run #{test}: #{e}"
+      false
+    end
+    duration = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+    File.open(results_path, 'a') do |file|
+      result = { 'test' => test, 'shard' => SHARD_NAME, 'success' => success, 'duration' => duration.round(3) }
+      result['reset'] = reset.round(3) if reset
+      file.puts(result.to_json)
+    end
+    success
+  end.all?
 end
 
 PORT = ENV.fetch('FLASK_PORT', '4723')
+ENV['FLASK_PORT'] = PORT # so tests know where to find us
 $stdout.sync = true # force immediate flushing without internal caching
 ENV['PYTHONUNBUFFERED'] = '0' # same for python subprocesses
 logger = Logger.new($stdout)
@@ -279,12 +598,13 @@ logger = Logger.new($stdout)
 logger.info 'Installing dependencies'
 datadir = File.absolute_path("#{__dir__}/../share/selenium-webdriver-at-spi/")
 requirements_installed_marker = "#{Dir.tmpdir}/selenium-requirements-installed"
-if !File.exist?(requirements_installed_marker) && File.exist?("#{datadir}/requirements.txt")
+if !ENV.include?('SELENIUM_REQUIREMENTS_INSTALLED') && !File.exist?(requirements_installed_marker) &&
+   File.exist?("#{datadir}/requirements.txt")
   raise 'pip3 not found in PATH!' unless system('which', 'pip3')
   unless system('pip3', 'install', '--disable-pip-version-check', '-r', 'requirements.txt', chdir: datadir,
-                out: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_pip_stdout.log"), err: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_pip_stderr.log"))
+                out: artifact_path("appium_artifact_#{artifact_name}_pip_stdout.log"), err: artifact_path("appium_artifact_#{artifact_name}_pip_stderr.log"))
     unless system('pip3', 'install', '--disable-pip-version-check', '--break-system-packages', '-r', 'requirements.txt',
-                  chdir: datadir, out: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_pip-break_stdout.log"))
+                  chdir: datadir, out: artifact_path("appium_artifact_#{artifact_name}_pip-break_stdout.log"))
       raise 'Failed to run pip3 install!'
     end
   end
@@ -296,7 +616,17 @@ if !File.exist?(requirements_installed_marker) && File.exist?("#{datadir}/requir
   end
 end
 
-if SYSTEMD_ASSISTED_CI
+if SHARDED
+  mode = ARGV.shift
+  count = ARGV.shift
+  abort "Usage: #{mode} N|auto test1 [test2 ...]" if count.nil? || ARGV.empty?
+  ret = ShardRunner.new(count: count == 'auto' ? Etc.nprocessors : Integer(count), tests: ARGV, logger: logger,
+                        pool: mode == '--pool').run
+  logger.info "run.rb exiting #{ret}"
+  ret ? exit : abort
+end
+
+if SYSTEMD_ASSISTED_CI && !SHARD_NAME
   # Prefer using systemd managed services. It's faster and more reliable than doing this manually.
   # ci-utilities mangles the environment - unmangle it so systemctl actually manages to talk to the daemon instance.
   ENV['DBUS_SESSION_BUS_ADDRESS'] = "unix:path=/run/user/#{`id -u`.strip}/bus"
@@ -329,40 +659,14 @@ CleanHome.with do
     ENV['AT_SPI_BUS_ADDRESS'] = at_bus_address
     Recorder.with do
       Driver.with(datadir) do
-        i = 0
-        begin
-          require 'net/http'
-          Net::HTTP.get(URI("http://localhost:#{PORT}/status"))
-        rescue => e
-          i += 1
-          if i < 30
-            logger.info 'not up yet'
-            sleep 0.5
-            retry
-          end
-          raise e
-        end
-
-        logger.info "starting test #{ARGV}"
-        ret = begin
-        system(*ARGV, exception: true, pgroup: true)
-      rescue RuntimeError # We intentionally let ENOENT raise out of this block
-        false
-      end
-      begin
-        # terminate the whole process group to try and make sure we also kill subprocesses of the test it hadn't cleaned up
-        test_proc = $?
-        Process.kill('TERM', -test_proc.pid)
-      rescue Errno::ESRCH
-        # group already dead, nothing to do
-      end
-      logger.info 'tests done'
+        ret = SHARD_NAME ? run_shard_tests(logger) : run_test(ARGV, logger)
+        logger.info 'tests done'
       end
     end
   end
 end
 
-system('ps aux', out: artifact_path("appium_artifact_#{File.basename(ARGV[0])}_ps_end.log"))
+system('ps aux', out: artifact_path("appium_artifact_#{artifact_name}_ps_end.log"))
 
 logger.info "run.rb exiting #{ret}"
 ret ? exit : abort
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <optional>
+
+#include <QByteArray>
+#include <QImage>
+#include <QStringView>
+
+/**
+ * Encodes screenshots. Most of the time of a screenshot used to go into deflating it at zlib's default level on one
+ * thread, so the PNG encoder here cuts the image into strips of rows and deflates them on as many threads as asked
+ * for, stitching the raw deflate streams into one IDAT the way pigz does. The result is a regular PNG.
+ *
+ * Where no PNG is needed there are cheaper formats: QOI, lossless and an order of magnitude faster than deflate, and
+ * raw, which is the pixels as KWin delivered them behind a small header.
+ *
+ * The pixels are read in the format ScreenShot2 delivers them in. When PNG or QOI can store them as they are they are
+ * not converted at all, the common 32 bit formats are swizzled row by row, anything else gets converted once up front.
+ */
+namespace Encoder
+{
+enum class Format {
+    Png,
+    Qoi,
+    Raw,
+};
+
+struct Options {
+    Format format = Format::Png;
+    int level = 6; // zlib level for PNG, 0 to 9
+    int threads = 1; // PNG strips deflated in parallel
+};
+
+[[nodiscard]] std::optional<Format> formatFromName(QStringView name);
+[[nodiscard]] const char *formatName(Format format);
+
+[[nodiscard]] QByteArray encode(const QImage &image, const Options &options);
+} // namespace Encoder
@@ -1,22 +1,31 @@
 // SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
 // SPDX-FileCopyrightText: 2022 Harald Sitter <sitter@kde.org>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <optional>
+#include <span>
+#include <vector>
 
-#include <QBuffer>
+#include <QCommandLineParser>
 #include <QDBusConnection>
 #include <QDBusInterface>
 #include <QDBusMessage>
 #include <QDBusReply>
 #include <QDBusUnixFileDescriptor>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QGuiApplication>
 #include <QImage>
+#include <QThread>
+#include <QThreadPool>
 #include <qplatformdefs.h>
 
+#include "encoder.h"
+#include "tracing.h"
+
 using namespace std::chrono_literals;
 
 // When the tests are run under an existing session, the well known org.kde.KWin name will be claimed by the real
@@ -77,19 +86,25 @@ static QImage allocateImage(const QVariantMap &metadata)
     return {width, height, QImage::Format(format)};
 }
 
-static QImage readImage(int pipeFd, const QVariantMap &metadata)
+// Reads the image into result, which is only (re)allocated when it doesn't fit the metadata already
+static bool readImage(int pipeFd, const QVariantMap &metadata, QImage &result)
 {
+    Tracing::Span span("pipe", "readImage");
     QFile out;
     if (!out.open(pipeFd, QFileDevice::ReadOnly, QFileDevice::AutoCloseHandle)) {
         qWarning() << "failed to open out pipe for reading";
         ::close(pipeFd);
-        return {};
+        return false;
     }
 
-    QImage result = allocateImage(metadata);
+    const QSize size(metadata.value(QStringLiteral("width")).toInt(), metadata.value(QStringLiteral("height")).toInt());
+    const auto format = QImage::Format(metadata.value(QStringLiteral("format")).toInt());
+    if (result.size() != size || result.format() != format) {
+        result = allocateImage(metadata);
+    }
     if (result.isNull()) {
         qWarning() << "failed to allocate image";
-        return {};
+        return false;
     }
 
     auto readData = 0;
@@ -98,13 +113,132 @@ static QImage readImage(int pipeFd, const QVariantMap &metadata)
             readData += ret;
         }
     }
-    return result;
+    return true;
+}
+
+static bool capture(const QString &service, QImage &image)
+{
+    auto pipeFds = std::to_array<int>({0, 0});
+    if (pipe2(pipeFds.data(), O_CLOEXEC | O_NONBLOCK) != 0) {
+        qWarning() << "failed to open pipe" << strerror(errno);
+        return false;
+    }
+
+    auto bus = QDBusConnection::sessionBus();
+    QDBusMessage message = QDBusMessage::createMethodCall(service,
+                                                          QStringLiteral("/org/kde/KWin/ScreenShot2"),
+                                                          QStringLiteral("org.kde.KWin.ScreenShot2"),
+                                                          QStringLiteral("CaptureActiveScreen")); // CaptureWorkspace is nicer but only available in plasma6
+    message << QVariantMap() << QVariant::fromValue(QDBusUnixFileDescriptor(pipeFds.at(1)));
+
+    QDBusPendingCall msg = bus.asyncCall(message);
+    {
+        Tracing::Span span("dbus", "ScreenShot2");
+        msg.waitForFinished();
+    }
+    ::close(pipeFds.at(1));
+    QDBusReply<QVariantMap> reply = msg.reply();
+    if (!reply.isValid()) {
+        qWarning() << reply.error();
+        ::close(pipeFds.at(0));
+        return false;
+    }
+
+    return readImage(pipeFds.at(0), reply.value(), image);
+}
+
+static QByteArray encode(const QImage &image, const Encoder::Options &options)
+{
+    Tracing::Span span("encode", Encoder::formatName(options.format));
+    span.setArg("width", image.width());
+    span.setArg("height", image.height());
+    span.setArg("threads", options.threads);
+    return Encoder::encode(image, options).toBase64();
+}
+
+// Every frame is a full screenshot that stays in memory until the burst is encoded
+constexpr int maxBurstFrames = 60;
+
+// Captures count frames, one every interval or as fast as possible for 0. The frames go into a pool of images
+// allocated up front, so capturing is little more than the D-Bus round trip and copying the pixels. Encoding happens
+// once all frames are in, on all cores. Prints one line per frame: the capture time in microseconds on CLOCK_MONOTONIC
+// and the base64 encoded image.
+static int burst(const QString &service, int count, std::chrono::milliseconds interval, Encoder::Options options)
+{
+    std::vector<QImage> frames(count);
+    std::vector<qint64> times(count);
+    {
+        Tracing::Span span("screenshot", "burst");
+        span.setArg("frames", count);
+        QElapsedTimer timer;
+        timer.start();
+        for (int frame = 0; frame < count; ++frame) {
+            if (const auto wait = interval * frame - std::chrono::milliseconds(timer.elapsed()); wait > 0ms) {
+                QThread::msleep(wait.count());
+            }
+            times.at(frame) = Tracing::now();
+            if (!capture(service, frames.at(frame))) {
+                return 1;
+            }
+            if (frame == 0) {
+                // Now that the size is known
+                for (auto &image : std::span(frames).subspan(1)) {
+                    image = QImage(frames.front().size(), frames.front().format());
+                }
+            }
+        }
+    }
+
+    // The frames are encoded side by side, each gets its share of the threads
+    options.threads = std::max(1, options.threads / count);
+    std::vector<QByteArray> encoded(count);
+    for (int frame = 0; frame < count; ++frame) {
+        QThreadPool::globalInstance()->start([&frames, &encoded, &options, frame] {
+            encoded.at(frame) = encode(frames.at(frame), options);
+        });
+    }
+    QThreadPool::globalInstance()->waitForDone();
+
+    for (int frame = 0; frame < count; ++frame) {
+        printf("%lld %s\n", times.at(frame), encoded.at(frame).constData());
+    }
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
     const QGuiApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Captures the active screen and prints it base64 encoded, as PNG unless asked otherwise."));
+    parser.addHelpOption();
+    const QCommandLineOption burstOption(QStringLiteral("burst"), QStringLiteral("capture this many frames, one line per frame"), QStringLiteral("count"));
+    parser.addOption(burstOption);
+    const QCommandLineOption intervalOption(QStringLiteral("interval"),
+                                            QStringLiteral("time between the frames of a burst, 0 for as fast as possible"),
+                                            QStringLiteral("ms"),
+                                            QStringLiteral("0"));
+    parser.addOption(intervalOption);
+    const QCommandLineOption encodingOption(QStringLiteral("encoding"),
+                                            QStringLiteral("png, qoi or raw (a 20 byte header and the pixels as KWin delivers them)"),
+                                            QStringLiteral("format"),
+                                            QStringLiteral("png"));
+    parser.addOption(encodingOption);
+    const QCommandLineOption levelOption(QStringLiteral("level"), QStringLiteral("PNG compression level, 0 to 9"), QStringLiteral("level"), QStringLiteral("6"));
+    parser.addOption(levelOption);
+    const QCommandLineOption threadsOption(QStringLiteral("threads"),
+                                           QStringLiteral("threads to deflate PNGs on"),
+                                           QStringLiteral("count"),
+                                           QString::number(QThread::idealThreadCount()));
+    parser.addOption(threadsOption);
+    const QCommandLineOption inputOption(QStringLiteral("input"),
+                                         QStringLiteral("encode this image instead of a screenshot and print the time it took to stderr"),
+                                         QStringLiteral("file"));
+    parser.addOption(inputOption);
+    // The geometry the driver passes is ignored, see below
+    parser.addPositionalArgument(QStringLiteral("geometry"), QStringLiteral("x y width height"), QStringLiteral("[x y width height]"));
+    parser.process(app);
+
     // Unfortunately since the geometries are not including the DPR we can only look at one screen
     // and hope that they are all the same :(
     //
@@ -120,43 +254,52 @@ int main(int argc, char **argv)
     // const auto height = int(args.takeFirst().toInt() * dpr);
     // Q_ASSERT(args.isEmpty());
 
+    const auto format = Encoder::formatFromName(parser.value(encodingOption));
+    if (!format.has_value()) {
+        qWarning() << "unknown encoding" << parser.value(encodingOption);
+        return 1;
+    }
+    const Encoder::Options options{
+        .format = format.value(),
+        .level = parser.value(levelOption).toInt(),
+        .threads = std::max(1, parser.value(threadsOption).toInt()),
+    };
+
+    if (parser.isSet(inputOption)) {
+        const QImage image(parser.value(inputOption));
+        if (image.isNull()) {
+            qWarning() << "failed to read" << parser.value(inputOption);
+            return 1;
+        }
+        const auto start = Tracing::now();
+        const auto encoded = encode(image, options);
+        fprintf(stderr, "encoded in %lld us\n", Tracing::now() - start);
+        printf("%s", encoded.constData());
+        return 0;
+    }
+
     const auto service = kwinService();
     if (!service.has_value()) {
         qWarning() << "kwin dbus service not resolved";
         return 1;
     }
 
-    auto pipeFds = std::to_array<int>({0, 0});
-    if (pipe2(pipeFds.data(), O_CLOEXEC | O_NONBLOCK) != 0) {
-        qWarning() << "failed to open pipe" << strerror(errno);
-        return 1;
+    if (parser.isSet(burstOption)) {
+        const auto count = parser.value(burstOption).toInt();
+        if (count < 1 || count > maxBurstFrames) {
+            qWarning() << "burst count must be between 1 and" << maxBurstFrames;
+            return 1;
+        }
+        return burst(service.value(),
+                     count,
+                     std::chrono::milliseconds(parser.value(intervalOption).toLongLong()),
+                     options);
     }
 
-    QVariantList arguments;
-    arguments.append(QVariantMap());
-    arguments.append(QVariant::fromValue(QDBusUnixFileDescriptor(pipeFds.at(1))));
-
-    auto bus = QDBusConnection::sessionBus();
-    QDBusMessage message = QDBusMessage::createMethodCall(service.value(),
-                                                          QStringLiteral("/org/kde/KWin/ScreenShot2"),
-                                                          QStringLiteral("org.kde.KWin.ScreenShot2"),
-                                                          QStringLiteral("CaptureActiveScreen")); // CaptureWorkspace is nicer but only available in plasma6
-    message << QVariantMap() << QVariant::fromValue(QDBusUnixFileDescriptor(pipeFds.at(1)));
-
-    QDBusPendingCall msg = bus.asyncCall(message);
-    msg.waitForFinished();
-    QDBusReply<QVariantMap> reply = msg.reply();
-    if (!reply.isValid()) {
-        qWarning() << reply.error();
+    QImage image;
+    if (!capture(service.value(), image)) {
         return 1;
     }
-
-    ::close(pipeFds.at(1));
-    const auto image = readImage(pipeFds.at(0), reply.value());
-    QBuffer buf;
-    image.save(&buf, "PNG");
-    printf("%s", buf.data().toBase64().constData()); // intentionally no newline so we don't need to strip on the py side
+    printf("%s", encode(image, options).constData()); // intentionally no newline so we don't need to strip on the py side
     return 0;
 }
-
-
@@ -1,27 +1,36 @@
 # SPDX-License-Identifier: AGPL-3.0-or-later
 # SPDX-FileCopyrightText: 2021-2023 Harald Sitter <sitter@kde.org>
 
+import argparse
 import base64
+import collections
+import functools
+import hashlib
 import json
 import logging
 import os
 import signal
+import struct
 import subprocess
 import sys
 import tempfile
+import threading
 import time
 import traceback
 import uuid
+from contextlib import contextmanager
 from datetime import datetime, timedelta
 from typing import cast
 
 import gi
 import numpy as np
 import pyatspi
-from flask import Flask, jsonify, request
+from flask import Flask, Response, jsonify, request
 from lxml import etree
 from werkzeug.exceptions import HTTPException
 
+import cbor
+import tracing
 from app_roles import ROLE_NAMES
 
 import logging
@@ -39,11 +48,101 @@ from gi.repository import Gdk, Gio, GLib, Gtk
 # https://www.freedesktop.org/wiki/Accessibility/PyAtSpi2Example/
 
 class SeleniumSpecialKeyError(RuntimeError): ...
+class NoSuchElementError(KeyError): ...
 
 EVENTLOOP_TIME = 0.1
 EVENTLOOP_TIME_LONG = 0.5
+# Typing through the registry: how many characters we may be ahead of the application, and how long it may go without
+# confirming any before we stop waiting for it.
+TYPING_WINDOW = 16
+TYPING_TIMEOUT = 1
+# How long we wait for replies of D-Bus calls we make ourselves, in ms. Same as pyatspi's (see setTimeout below).
+PROPERTY_CALL_TIMEOUT = 4000
+# How much the tile hashes of baselines may take on disk, in bytes. The least recently used go first.
+TILE_HASH_CACHE_SIZE = 64 * 1024 * 1024
+# How many elements a session remembers. Finding more forgets the least recently used ones.
+ELEMENT_STORE_SIZE = int(os.getenv('SELENIUM_ELEMENT_STORE_SIZE', '4096'))
+# How many frames one burst of screenshots may have. They are all held in memory, raw and encoded, until it is over.
+BURST_MAX_FRAMES = 60
 sys.stdout = sys.stderr
 sessions = {}  # global dict of open sessions
+# The server is threaded so multiple test clients may talk to us at the same time. The sessions dict is guarded by
+# sessions_lock, everything inside a session is guarded by the session's own lock (see session_locked).
+sessions_lock = threading.Lock()
+# There is only one seat. Synthesized input of concurrent sessions must not interleave or we'd type garbage.
+# Taken before atspi_lock, see holding_input.
+input_lock = threading.Lock()
+
+
+class AtspiLock:
+    # libatspi, GLib and GTK are not thread safe. Worse, a blocking at-spi call dispatches whatever messages arrive
+    # meanwhile, and with them our event listeners, on the thread making it. So all of it happens under this one lock,
+    # which requests hold for their whole duration (see session_locked) and let go of while they wait on something
+    # else: helper processes, sleeps, the input lock (see released). It is reentrant and first come first served, so
+    # letting go of it for a moment hands it to whoever waited longest.
+    def __init__(self) -> None:
+        self.condition = threading.Condition()
+        self.owner = None
+        self.depth = 0
+        self.queue = collections.deque()
+
+    def __enter__(self):
+        me = threading.get_ident()
+        with self.condition:
+            if self.owner == me:
+                self.depth += 1
+                return self
+            ticket = object()
+            self.queue.append(ticket)
+            self.condition.wait_for(lambda: self.owner is None and self.queue[0] is ticket)
+            self.queue.popleft()
+            self.owner = me
+            self.depth = 1
+        return self
+
+    def __exit__(self, *exc):
+        with self.condition:
+            self.depth -= 1
+            if self.depth == 0:
+                self.owner = None
+                self.condition.notify_all()
+
+    @contextmanager
+    def released(self):
+        # Lets go of the lock for the duration, however deeply this thread holds it
+        with self.condition:
+            depth = self.depth if self.owner == threading.get_ident() else 0
+            if depth:
+                self.owner = None
+                self.depth = 0
+                self.condition.notify_all()
+        try:
+            yield
+        finally:
+            if depth:
+                self.__enter__()
+                with self.condition:
+                    self.depth = depth
+
+    def yield_turn(self):
+        # Lets whoever waits for the lock have it before we continue
+        with self.released():
+            pass
+
+
+atspi_lock = AtspiLock()
+
+
+@contextmanager
+def holding_input():
+    # The input lock may be held a long time, by someone who needs atspi_lock meanwhile. Wait for it without blocking
+    # at-spi for everyone else.
+    with atspi_lock.released():
+        input_lock.acquire()
+    try:
+        yield
+    finally:
+        input_lock.release()
 
 logger = logging.Logger("selenium-webdriver-at-spi", logging.INFO)
 
@@ -55,6 +154,11 @@ pyatspi.setTimeout(4000, 15000)
 app = Flask(__name__)
 
 
+@app.errorhandler(NoSuchElementError)
+def no_such_element_error(e):
+    return errorFromMessage(error='no such element', message=f'element {e} is unknown or was forgotten, find it again'), 404
+
+
 @app.errorhandler(Exception)
 def unknown_error(e):
     if isinstance(e, HTTPException):
@@ -62,6 +166,30 @@ def unknown_error(e):
 
     return errorFromException(error='unknown error', exception=e), 500
 
+@app.before_request
+def trace_request_begin():
+    tracing.begin_request((request.view_args or {}).get('session_id'))
+
+
+@app.teardown_request
+def trace_request_end(_exception):
+    tracing.end_request(f'{request.method} {request.url_rule.rule if request.url_rule else "unknown"}')
+
+
+@app.route('/metrics', methods=['GET'])
+def metrics():
+    return tracing.metrics(), 200, {'content-type': 'text/plain; version=0.0.4'}
+
+
+@app.route('/session/<session_id>/trace', methods=['GET'])
+def session_trace(session_id):
+    # Not locked, the trace is kept for a while after the session is gone
+    document = tracing.trace(session_id)
+    if document is None:
+        return json.dumps({'value': {'error': 'no such trace'}}), 404, {'content-type': 'application/json'}
+    return json.dumps(document), 200, {'content-type': 'application/json'}
+
+
 @app.route('/status', methods=['GET'])
 def status():
     body = {
@@ -73,6 +201,195 @@ def status():
     return json.dumps(body), 200, {'content-type': 'application/json'}
 
 
+def run_helper(args, **kwargs):
+    # Helper processes block only the calling request thread, every request has a thread of its own. Waiting on them
+    # releases the GIL and atspi_lock, so requests of other sessions are served in the meantime.
+    if 'env' not in kwargs:
+        kwargs['env'] = tracing.helper_environment()
+    with tracing.span('spawn', os.path.basename(args[0])), atspi_lock.released():
+        return subprocess.run(args, **kwargs)
+
+
+def spin_until(predicate, timeout):
+    # Dispatches the GLib main context, and with it at-spi events, until predicate() is true or timeout seconds have
+    # passed. Returns the final state of the predicate. The iteration blocks until something happens, so we notice
+    # events the moment they arrive instead of sleeping a fixed time. The blocking is sliced so requests of other
+    # sessions get their turn in between.
+    deadline = time.monotonic() + timeout
+    context = GLib.MainContext.default()
+    while not predicate():
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+            return False
+        with atspi_lock:
+            if predicate():
+                break
+            woken = []
+            source_id = GLib.timeout_add(int(min(remaining, EVENTLOOP_TIME) * 1000) + 1, lambda: woken.append(True))
+            context.iteration(True)
+            if not woken:
+                GLib.source_remove(source_id)
+        atspi_lock.yield_turn()
+    return True
+
+
+def bus_name(accessible):
+    # The unique name of the application owning accessible on the a11y bus
+    return getattr(getattr(accessible, 'app', None), 'bus_name', None)
+
+
+# What an application does in response to us manipulating it
+FOCUS_EVENTS = ['object:state-changed:focused']
+REACTION_EVENTS = ['object:state-changed', 'object:property-change', 'object:children-changed', 'object:text-changed',
+                   'object:selection-changed', 'window']
+
+
+class SettleWaiter:
+    # Waits for an application to settle after something was done to it. While the context is active we count the
+    # at-spi events of event_types the application sends, wait() returns as soon as a new one arrived and the
+    # application answers a round trip, i.e. has worked through what came before. Actions without a visible reaction
+    # wait timeout, which is as long as we used to sleep after every action, so slow hosts get no less time than they
+    # used to while responsive ones don't wait for nothing. Without an accessible events of any application count.
+    def __init__(self, accessible, event_types, timeout=EVENTLOOP_TIME):
+        self.accessible = accessible
+        self.bus_name = bus_name(accessible) if accessible else None
+        self.event_types = event_types
+        self.timeout = timeout
+        self.seen = 0
+        self.consumed = 0
+
+    def _matches(self, event):
+        return not self.bus_name or (event.source and bus_name(event.source) == self.bus_name)
+
+    def _on_event(self, event):
+        if self._matches(event):
+            self.seen += 1
+
+    def __enter__(self):
+        pyatspi.Registry.registerEventListener(self._on_event, *self.event_types)
+        return self
+
+    def __exit__(self, *exc):
+        pyatspi.Registry.deregisterEventListener(self._on_event, *self.event_types)
+
+    @tracing.traced('wait', 'settle')
+    def wait(self):
+        reacted = spin_until(lambda: self.seen > self.consumed, self.timeout)
+        self.consumed = self.seen
+        if reacted:
+            self.probe()
+        return reacted
+
+    @tracing.traced('wait', 'settle')
+    def wait_for(self, count):
+        # Waits until count events were seen, for as long as they keep coming at least every timeout
+        while self.seen < count:
+            before = self.seen
+            if not spin_until(lambda: self.seen >= count, self.timeout) and self.seen == before:
+                return False
+        return True
+
+    @tracing.traced('atspi', 'probe')
+    def probe(self):
+        # Extents are never cached, so this is a call into the application which it answers only once it has dealt
+        # with what it was busy with. Dispatch whatever it sent meanwhile so the at-spi cache is up to date.
+        if not self.accessible:
+            return
+        try:
+            self.accessible.queryComponent().getExtents(pyatspi.DESKTOP_COORDS)
+        except (gi.repository.GLib.GError, NotImplementedError):
+            pass
+        with atspi_lock:
+            context = GLib.MainContext.default()
+            while context.pending():
+                context.iteration(False)
+
+
+class TextInsertionCounter(SettleWaiter):
+    # Counts the characters an application inserts into its text elements
+    def __init__(self, accessible, timeout):
+        super().__init__(accessible, ['object:text-changed:insert'], timeout)
+
+    def _on_event(self, event):
+        if self._matches(event):
+            self.seen += max(1, len(event.any_data or ''))
+
+
+def focus_element(action, index, element):
+    # Runs the SetFocus action (at index) and waits for the element to have focus
+    with SettleWaiter(element, FOCUS_EVENTS) as waiter:
+        with tracing.span('atspi', 'doAction', action='SetFocus'):
+            action.doAction(index)
+        waiter.wait()
+
+
+# Process ids of applications by their unique name on the a11y bus. Unique names are never reused, so entries never go
+# stale. Saves us a GetConnectionUnixProcessID round trip per application on every scan of the desktop.
+application_pids = {}
+application_pids_lock = threading.Lock()
+
+
+def application_pid(app):
+    # The unique bus name of the application, resolved to its pid by the bus daemon through get_process_id().
+    bus_name = getattr(getattr(app, 'app', None), 'bus_name', None)
+    if bus_name:
+        with application_pids_lock:
+            if bus_name in application_pids:
+                return application_pids[bus_name]
+    pid = app.get_process_id()
+    if bus_name:
+        with application_pids_lock:
+            application_pids[bus_name] = pid
+    return pid
+
+
+@tracing.traced('atspi')
+def find_application(pid):
+    for desktop_index in range(pyatspi.Registry.getDesktopCount()):
+        desktop = pyatspi.Registry.getDesktop(desktop_index)
+        for app in desktop:
+            try:
+                if application_pid(app) == pid:
+                    return app
+            except (gi.repository.GLib.GError, AttributeError):
+                print('stumbled over a broken process. ignoring...')
+                continue
+    return None
+
+
+@tracing.traced('wait')
+def wait_for_application(pid, end_time):
+    # The registry announces every application that shows up on the bus with a children-changed:add event on the
+    # desktop, the new application being the event's any_data. Look for our pid once up front (it may already be
+    # there) and then only check the applications that get added, which costs a single pid lookup each.
+    # Every second we scan the whole desktop regardless, in case an event got lost.
+    found = []
+
+    def on_children_changed(event):
+        app = event.any_data
+        if found or not app or not event.source or event.source.getRole() != pyatspi.ROLE_DESKTOP_FRAME:
+            return
+        try:
+            if application_pid(app) == pid:
+                found.append(app)
+        except (gi.repository.GLib.GError, AttributeError):
+            print('stumbled over a broken process. ignoring...')
+
+    pyatspi.Registry.registerEventListener(on_children_changed, 'object:children-changed:add')
+    try:
+        app = find_application(pid)
+        while not app:
+            remaining = (end_time - datetime.now()).total_seconds()
+            if remaining <= 0:
+                return None
+            if spin_until(lambda: len(found) > 0, min(remaining, 1)):
+                return found[0]
+            app = find_application(pid)
+        return app
+    finally:
+        pyatspi.Registry.deregisterEventListener(on_children_changed, 'object:children-changed:add')
+
+
 def maybe_special_key_error(text):
     for c in text:
         if c >= '\ue000': # first selenium special key
@@ -80,6 +397,16 @@ def maybe_special_key_error(text):
     return
 
 
+def create_tree(accessible):
+    with tracing.span('atspi', 'tree'):
+        return _createNode2(accessible, None)
+
+
+def serialize_tree(doc, pretty_print=False):
+    with tracing.span('serialize', 'xml'):
+        return etree.tostring(doc, pretty_print=pretty_print).decode("utf-8")
+
+
 def _createNode2(accessible, parentElement, indexInParents=[]):
     if not accessible:
         return
@@ -134,6 +461,87 @@ def errorFromException(error, exception):
 def index():
     return 'Servas'
 
+
+def get_session(session_id):
+    with sessions_lock:
+        return sessions.get(session_id)
+
+
+def session_locked(func):
+    # Serializes all requests of one session, they queue up on its lock. WebDriver commands of a session are sequential
+    # by nature, but requests of different sessions run in parallel on the threads of the server, taking turns on
+    # atspi_lock. Blocking work other than at-spi (sleeps, helper processes) only ever holds up the session that
+    # caused it. The route gets the session instead of its id.
+    @functools.wraps(func)
+    def wrapper(session_id, *args, **kwargs):
+        session = get_session(session_id)
+        if not session:
+            return json.dumps({'value': {'error': 'invalid session id'}}), 404, {'content-type': 'application/json'}
+        with session.lock:
+            if get_session(session_id) is not session:  # deleted while we queued
+                return json.dumps({'value': {'error': 'invalid session id'}}), 404, {'content-type': 'application/json'}
+            with atspi_lock:
+                return func(session, *args, **kwargs)
+    return wrapper
+
+class ElementStore:
+    # The elements of a session by id, so they can be interacted with after finding them. Holds at most
+    # ELEMENT_STORE_SIZE elements, finding more evicts the least recently used. Looking up an unknown (or evicted) id
+    # raises NoSuchElementError, get() returns None instead.
+    evictions = 0  # of all stores, for the metrics
+
+    def __init__(self, size=ELEMENT_STORE_SIZE) -> None:
+        self.size = size
+        self.elements = collections.OrderedDict()
+
+    def __setitem__(self, element_id, element):
+        self.elements[element_id] = element
+        self.elements.move_to_end(element_id)
+        while len(self.elements) > self.size:
+            self.elements.popitem(last=False)
+            ElementStore.evictions += 1
+
+    def __getitem__(self, element_id):
+        if element_id not in self.elements:
+            raise NoSuchElementError(element_id)
+        self.elements.move_to_end(element_id)
+        return self.elements[element_id]
+
+    def get(self, element_id):
+        try:
+            return self[element_id]
+        except NoSuchElementError:
+            return None
+
+    def __len__(self):
+        return len(self.elements)
+
+    def clear(self):
+        self.elements.clear()
+
+
+def resident_memory():
+    # In bytes, from the resident pages in /proc/self/statm
+    with open('/proc/self/statm') as file:
+        return int(file.read().split()[1]) * os.sysconf('SC_PAGE_SIZE')
+
+
+def session_element_count():
+    with sessions_lock:
+        return sum(len(session.elements) for session in sessions.values())
+
+
+def session_count():
+    with sessions_lock:
+        return len(sessions)
+
+
+tracing.add_metric('selenium_webdriver_at_spi_sessions', 'gauge', 'Open sessions.', session_count)
+tracing.add_metric('selenium_webdriver_at_spi_elements', 'gauge', 'Elements remembered by all sessions.', session_element_count)
+tracing.add_metric('selenium_webdriver_at_spi_element_evictions_total', 'counter',
+                   'Elements forgotten because their session remembered too many.', lambda: ElementStore.evictions)
+tracing.add_metric('process_resident_memory_bytes', 'gauge', 'Resident memory size in bytes.', resident_memory)
+
 # Encapsulates a Session object. Sessions are opened by the client and contain elements. A session is generally speaking
 # an app.
 # TODO: should we expose the root scope somehow? requires a special variant of session and moving logic from the
@@ -144,7 +552,10 @@ class Session:
 
     def __init__(self) -> None:
         self.id = str(uuid.uuid1())
-        self.elements = {}  # a cache to hold elements between finding and interacting with
+        # Trace the launch too
+        tracing.start_session(self.id)
+        self.lock = threading.RLock()
+        self.elements = ElementStore()  # a cache to hold elements between finding and interacting with
         self.browsing_context = None
         self.pid = -1
         # implicit deviates from spec, 0 is unreasonable
@@ -206,23 +617,7 @@ class Session:
 
         def on_launched(context, info, platform_data):
             self.pid = platform_data['pid']
-
-            while datetime.now() < end_time:
-                time.sleep(1) # do not overwhelm the bus with queries, wait a bit
-                for desktop_index in range(pyatspi.Registry.getDesktopCount()):
-                    desktop = pyatspi.Registry.getDesktop(desktop_index)
-                    for app in desktop:
-                        try:
-                            if app.get_process_id() == self.pid:
-                                self.browsing_context = app
-                                break
-                        except (gi.repository.GLib.GError, AttributeError):
-                            print('stumbled over a broken process. ignoring...')
-                            continue
-                    if self.browsing_context:
-                        break
-                if self.browsing_context:
-                    break
+            self.browsing_context = wait_for_application(self.pid, end_time)
             if not self.browsing_context:
                 raise RuntimeError('Failed to find application on a11y bus within time limit! It either crashed, or was too slow to start, or is stuck.')
 
@@ -239,6 +634,10 @@ class Session:
             appinfo.launch([], context)
 
     def close(self) -> None:
+        tracing.finish_session(self.id)
+        # Let go of the proxies, whoever still holds on to the session object mustn't keep them alive
+        self.elements.clear()
+        self.browsing_context = None
         if self.launched:
             try:
                 os.kill(self.pid, signal.SIGKILL)
@@ -253,42 +652,47 @@ def session():
         # https://www.w3.org/TR/webdriver1/#new-session
         # 1, 3, 4, 5, 8, 9, 11, 12, 13, 14
         try:
-            session = Session()
+            with atspi_lock:
+                session = Session()
         except Exception as e:
             return errorFromException(error='session not created', exception=e), 500
-        sessions[session.id] = session
 
         if session.browsing_context is None:
+            session.close()
             return errorFromMessage(error='session not created',
                                     message='Application was not found on the a11y bus for unknown reasons. It probably failed to register on the bus.'), 500
 
+        with sessions_lock:
+            sessions[session.id] = session
         return json.dumps({'value': {'sessionId': session.id, 'capabilities': {"app": session.browsing_context.name}}}), 200, {'content-type': 'application/json'}
     elif request.method == 'GET':
         # TODO impl
         print("GET called when not expected", request)
     elif request.method == 'DELETE':
-        # TODO spec review
+        # Not in the spec. Closes all sessions so a warm driver can be reused by the next test (run.rb pool mode).
+        with sessions_lock:
+            closing = list(sessions.values())
+            sessions.clear()
+        for session in closing:
+            with session.lock, atspi_lock:
+                session.close()
         return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>', methods=['DELETE'])
-def session_delete(session_id):
+@session_locked
+def session_delete(session):
     if request.method == 'DELETE':
         # TODO spec review
-        session = sessions[session_id]
-        if not session:
-            return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+        with sessions_lock:
+            sessions.pop(session.id, None)
         session.close()
         return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/timeouts/implicit_wait', methods=['POST'])
-def session_implicit_wait(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_implicit_wait(session):
     blob = json.loads(request.data)
     ms = blob['ms']
 
@@ -297,30 +701,25 @@ def session_implicit_wait(session_id):
 
 
 @app.route('/session/<session_id>/source', methods=['GET'])
-def session_source(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
-    doc = _createNode2(session.browsing_context, None)
-    return json.dumps({'value': etree.tostring(doc, pretty_print=False).decode("utf-8")}), 200, {'content-type': 'application/xml'}
+@session_locked
+def session_source(session):
+    doc = create_tree(session.browsing_context)
+    return json.dumps({'value': serialize_tree(doc)}), 200, {'content-type': 'application/xml'}
 
 
 # NB: custom method to get the source without json wrapper
 @app.route('/session/<session_id>/sourceRaw', methods=['GET'])
-def session_source_raw(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
-    doc = _createNode2(session.browsing_context, None)
-    return etree.tostring(doc, pretty_print=True).decode("utf-8"), 200, {'content-type': 'application/xml'}
+@session_locked
+def session_source_raw(session):
+    doc = create_tree(session.browsing_context)
+    return serialize_tree(doc, pretty_print=True), 200, {'content-type': 'application/xml'}
 
 def check_requires_button_compat():
     major, minor, _micro = pyatspi.Atspi.get_version()
     return major > 2 or (major == 2 and minor >= 53)
 requires_button_compat = check_requires_button_compat()
 
+@tracing.traced('atspi')
 def locator(session, strategy, selector, start, findAll = False):
     end_time = datetime.now() + \
         timedelta(milliseconds=session.timeouts['implicit'])
@@ -328,7 +727,7 @@ def locator(session, strategy, selector, start, findAll = False):
 
     while datetime.now() < end_time:
         if strategy == 'xpath':
-            doc = _createNode2(start, None)
+            doc = create_tree(start)
             for c in doc.xpath(selector):
                 path = [int(x) for x in c.get('path').split()]
                 # path is relative to the app root, not our start item!
@@ -375,11 +774,11 @@ def locator(session, strategy, selector, start, findAll = False):
 
 
 @app.route('/session/<session_id>/element', methods=['GET', 'POST'])
-def session_element(session_id=None):
+@session_locked
+def session_element(session):
     # https://www.w3.org/TR/webdriver1/#dfn-find-element
 
     # TODO scope elements to session somehow when the session gets closed we can throw away the references
-    session = sessions[session_id]
     blob = json.loads(request.data)
 
     strategy = blob['using']
@@ -403,11 +802,11 @@ def session_element(session_id=None):
 
 
 @app.route('/session/<session_id>/elements', methods=['GET', 'POST'])
-def session_element2(session_id=None):
+@session_locked
+def session_element2(session):
     # https://www.w3.org/TR/webdriver1/#dfn-find-elements
 
     # TODO scope elements to session somehow when the session gets closed we can throw away the references
-    session = sessions[session_id]
     blob = json.loads(request.data)
 
     strategy = blob['using']
@@ -434,15 +833,9 @@ def session_element2(session_id=None):
 
 
 @app.route('/session/<session_id>/element/<element_id>/click', methods=['GET', 'POST'])
-def session_element_click(session_id, element_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_element_click(session, element_id):
     element = session.elements[element_id]
-    if not element:
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
-
     action = element.queryAction()
     availableActions = {}
     for i in range(0, action.nActions):
@@ -450,100 +843,249 @@ def session_element_click(session_id, element_id):
 
     keys = availableActions.keys()
     if 'SetFocus' in keys: # this is used in addition to actual actions so focus is where it would be expected after a click
-        action.doAction(availableActions['SetFocus'])
-        time.sleep(EVENTLOOP_TIME)
+        focus_element(action, availableActions['SetFocus'], element)
+
+    with SettleWaiter(element, REACTION_EVENTS) as waiter:
+        try:
+            with tracing.span('atspi', 'doAction'):
+                if 'Press' in keys:
+                    action.doAction(availableActions['Press'])
+                elif 'Toggle' in keys:
+                    action.doAction(availableActions['Toggle'])
+                elif 'ShowMenu' in keys:
+                    action.doAction(availableActions['ShowMenu'])
+        except gi.repository.GLib.GError as e:
+            print(e)
+            print("Ignoring! There is a chance your application is misbehaving. Could also just be a blocked eventloop though.")
+        waiter.wait()
+
+    return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
+
+
+class ElementProperties:
+    # The data element properties are derived from: the state set, the extents, the text and a few D-Bus properties.
+    # Each is fetched at most once, however many properties are asked for. prefetch_element_properties() may fill
+    # them in ahead of time, whatever it didn't get is fetched through pyatspi on demand.
+    def __init__(self, element):
+        self.element = element
+        self.fetched = {}
 
+    def _fetch(self, key, fetch):
+        if key not in self.fetched:
+            self.fetched[key] = fetch()
+        return self.fetched[key]
+
+    def states(self):
+        return self._fetch('states', lambda: {int(state) for state in self.element.getState().getStates()})
+
+    def extents(self):
+        def fetch():
+            extents = self.element.queryComponent().getExtents(pyatspi.XY_SCREEN)
+            return (extents.x, extents.y, extents.width, extents.height)
+        return self._fetch('extents', fetch)
+
+    def text(self):
+        # None when the element has no text interface
+        def fetch():
+            try:
+                return self.element.queryText().getText(0, -1)
+            except NotImplementedError:
+                return None
+        return self._fetch('text', fetch)
+
+    def name(self):
+        return self._fetch('name', lambda: self.element.name)
+
+    def accessible_id(self):
+        return self._fetch('accessibleId', lambda: self.element.accessibleId)
+
+    def value(self):
+        return self._fetch('value', lambda: self.element.queryValue().currentValue)
+
+    def has_state(self, state):
+        return int(state) in self.states()
+
+    def get(self, name):
+        if name == 'rect':
+            x, y, width, height = self.extents()
+            return {'x': x, 'y': y, 'width': width, 'height': height}
+        if name == 'text':
+            text = self.text()
+            return text if text is not None else self.name()
+        if name == 'enabled':
+            return self.has_state(pyatspi.STATE_ENABLED)
+        if name == 'displayed':
+            return self.has_state(pyatspi.STATE_VISIBLE) and self.has_state(pyatspi.STATE_SHOWING)
+        if name == 'selected':
+            return self.has_state(pyatspi.STATE_SELECTED) or self.has_state(pyatspi.STATE_FOCUSED)
+        if name == 'accessibility-id':
+            return self.accessible_id()
+        if name == 'name':
+            return self.name()
+        if name == 'value':
+            return self.value()
+        for value, string in pyatspi.STATE_VALUE_TO_NAME.items():
+            if string == name:
+                return self.has_state(value)
+        return None
+
+
+# What ElementProperties.get() needs for each property. Everything else is a state.
+PROPERTY_SOURCES = {
+    'rect': ['extents'],
+    'text': ['text', 'name'],
+    'accessibility-id': ['accessibleId'],
+    'name': ['name'],
+    'value': ['value'],
+}
+
+# The D-Bus calls behind the sources: interface, method, arguments, reply type and how to turn the reply into what
+# ElementProperties stores.
+PROPERTY_CALLS = {
+    'states': ('org.a11y.atspi.Accessible', 'GetState', None, '(au)',
+               lambda reply: {bit + 32 * index for index, word in enumerate(reply[0]) for bit in range(32) if word & (1 << bit)}),
+    'extents': ('org.a11y.atspi.Component', 'GetExtents', GLib.Variant('(u)', (int(pyatspi.XY_SCREEN),)), '((iiii))',
+                lambda reply: tuple(reply[0])),
+    'text': ('org.a11y.atspi.Text', 'GetText', GLib.Variant('(ii)', (0, -1)), '(s)', lambda reply: reply[0]),
+    'name': ('org.freedesktop.DBus.Properties', 'Get', GLib.Variant('(ss)', ('org.a11y.atspi.Accessible', 'Name')), '(v)',
+             lambda reply: reply[0]),
+    'accessibleId': ('org.freedesktop.DBus.Properties', 'Get', GLib.Variant('(ss)', ('org.a11y.atspi.Accessible', 'AccessibleId')),
+                     '(v)', lambda reply: reply[0]),
+    'value': ('org.freedesktop.DBus.Properties', 'Get', GLib.Variant('(ss)', ('org.a11y.atspi.Value', 'CurrentValue')), '(v)',
+              lambda reply: reply[0]),
+}
+
+
+@functools.cache
+def a11y_bus():
+    # Our own connection to the accessibility bus, for talking to applications without going through pyatspi
+    address = os.environ.get('AT_SPI_BUS_ADDRESS')
+    if not address:
+        session_bus = Gio.bus_get_sync(Gio.BusType.SESSION, None)
+        reply = session_bus.call_sync('org.a11y.Bus', '/org/a11y/bus', 'org.a11y.Bus', 'GetAddress', None,
+                                      GLib.VariantType('(s)'), Gio.DBusCallFlags.NONE, -1, None)
+        address = reply.unpack()[0]
+    flags = Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT | Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION
+    return Gio.DBusConnection.new_for_address_sync(address, flags, None, None)
+
+
+@tracing.traced('atspi')
+def prefetch_element_properties(snapshots, properties):
+    # Sends the D-Bus calls for all elements and properties at once and collects the replies as they come in, rather
+    # than making one blocking round trip after the other. Calls that fail (e.g. the element lacks the interface) are
+    # left for ElementProperties to retry through pyatspi, which knows how to handle that.
+    sources = set()
+    for name in properties:
+        sources.update(PROPERTY_SOURCES.get(name, ['states']))
     try:
-        if 'Press' in keys:
-            action.doAction(availableActions['Press'])
-        elif 'Toggle' in keys:
-            action.doAction(availableActions['Toggle'])
-        elif 'ShowMenu' in keys:
-            action.doAction(availableActions['ShowMenu'])
+        bus = a11y_bus()
     except gi.repository.GLib.GError as e:
-        print(e)
-        print("Ignoring! There is a chance your application is misbehaving. Could also just be a blocked eventloop though.")
-    time.sleep(EVENTLOOP_TIME)
+        print(f'no connection to the accessibility bus, not prefetching: {e}')
+        return
 
-    return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
+    pending = []
+
+    def on_reply(connection, result, data):
+        snapshot, source, convert = data
+        try:
+            snapshot.fetched[source] = convert(connection.call_finish(result).unpack())
+        except gi.repository.GLib.GError:
+            pass
+        pending.remove(data)
+
+    for snapshot in snapshots:
+        destination = bus_name(snapshot.element)
+        path = getattr(snapshot.element, 'path', None)
+        if not destination or not path:
+            continue
+        for source in sources:
+            interface, method, arguments, reply_type, convert = PROPERTY_CALLS[source]
+            data = (snapshot, source, convert)
+            pending.append(data)
+            bus.call(destination, path, interface, method, arguments, GLib.VariantType(reply_type),
+                     Gio.DBusCallFlags.NONE, PROPERTY_CALL_TIMEOUT, None, on_reply, data)
+    spin_until(lambda: not pending, PROPERTY_CALL_TIMEOUT / 1000)
 
 
 @app.route('/session/<session_id>/element/<element_id>/text', methods=['GET'])
-def session_element_text(session_id, element_id):
-    session = sessions[session_id]
+@session_locked
+def session_element_text(session, element_id):
     element = session.elements[element_id]
-    try:
-        textElement = element.queryText()
-        return json.dumps({'value': textElement.getText(0, -1)}), 200, {'content-type': 'application/json'}
-    except NotImplementedError:
-        return json.dumps({'value': element.name}), 200, {'content-type': 'application/json'}
+    return json.dumps({'value': ElementProperties(element).get('text')}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/element/<element_id>/enabled', methods=['GET'])
-def session_element_enabled(session_id, element_id):
-    session = sessions[session_id]
+@session_locked
+def session_element_enabled(session, element_id):
     element = session.elements[element_id]
-    return json.dumps({'value': element.getState().contains(pyatspi.STATE_ENABLED)}), 200, {'content-type': 'application/json'}
+    return json.dumps({'value': ElementProperties(element).get('enabled')}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/element/<element_id>/rect', methods=['GET'])
-def session_element_rect(session_id, element_id):
-    session = sessions[session_id]
+@session_locked
+def session_element_rect(session, element_id):
     element = session.elements[element_id]
-    x, y = element.queryComponent().getPosition(pyatspi.XY_SCREEN)
-    w, h = element.queryComponent().getSize()
-    return json.dumps({'value': {'x': x, 'y': y, 'width': w, 'height': h} }), 200, {'content-type': 'application/json'}
+    return json.dumps({'value': ElementProperties(element).get('rect')}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/element/<element_id>/displayed', methods=['GET'])
-def session_element_displayed(session_id, element_id):
-    session = sessions[session_id]
+@session_locked
+def session_element_displayed(session, element_id):
     element = session.elements[element_id]
-    return json.dumps({'value': element.getState().contains(pyatspi.STATE_VISIBLE) and element.getState().contains(pyatspi.STATE_SHOWING)}), 200, {'content-type': 'application/json'}
+    return json.dumps({'value': ElementProperties(element).get('displayed')}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/element/<element_id>/selected', methods=['GET'])
-def session_element_selected(session_id, element_id):
-    session = sessions[session_id]
+@session_locked
+def session_element_selected(session, element_id):
     element = session.elements[element_id]
-    return json.dumps({'value': (element.getState().contains(pyatspi.STATE_SELECTED) or element.getState().contains(pyatspi.STATE_FOCUSED))}), 200, {'content-type': 'application/json'}
+    return json.dumps({'value': ElementProperties(element).get('selected')}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/element/<element_id>/attribute/<name>', methods=['GET'])
-def session_element_attribute(session_id, element_id, name):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_element_attribute(session, element_id, name):
     element = session.elements[element_id]
-    if not element:
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
-
-    if name == "accessibility-id":
-        return json.dumps({'value': element.accessibleId}), 200, {'content-type': 'application/json'}
-
-    if name == "name":
-        return json.dumps({'value': element.name}), 200, {'content-type': 'application/json'}
+    return json.dumps({'value': ElementProperties(element).get(name)}), 200, {'content-type': 'application/json'}
 
-    if name == "value":
-        elementValue = element.queryValue()
-        return json.dumps({'value': elementValue.currentValue}), 200, {'content-type': 'application/json'}
 
-    result = None
-    for value, string in pyatspi.STATE_VALUE_TO_NAME.items():
-        if string == name:
-            result = element.getState().contains(value)
-            break
-
-    return json.dumps({'value': result}), 200, {'content-type': 'application/json'}
+# Not in the spec. Reads any number of properties of any number of elements in one go. Takes
+# {"elements": [element ids], "properties": [names]}, the names being those of the single property routes (rect, text,
+# enabled, displayed, selected) or anything the attribute route takes. Returns {element id: {name: value}}.
+@app.route('/session/<session_id>/elements/properties', methods=['POST'])
+@session_locked
+def session_elements_properties(session):
+    blob = json.loads(request.data)
+    return json.dumps({'value': element_properties(session, blob['elements'], blob['properties'])}), 200, {'content-type': 'application/json'}
+
+
+def element_properties(session, element_ids, properties):
+    snapshots = {}
+    for element_id in element_ids:
+        element = session.elements.get(element_id)
+        if element:
+            snapshots[element_id] = ElementProperties(element)
+    prefetch_element_properties(snapshots.values(), properties)
+
+    result = {}
+    for element_id in element_ids:
+        snapshot = snapshots.get(element_id)
+        if not snapshot:
+            result[element_id] = {'error': 'no such element'}
+            continue
+        values = {}
+        for name in properties:
+            try:
+                values[name] = snapshot.get(name)
+            except (NotImplementedError, gi.repository.GLib.GError):
+                values[name] = None
+        result[element_id] = values
+    return result
 
 
 @app.route('/session/<session_id>/element/<element_id>/element', methods=['POST'])
-def session_element_element(session_id, element_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_element_element(session, element_id):
     blob = json.loads(request.data)
     strategy = blob['using']
     selector = blob['value']
@@ -551,9 +1093,6 @@ def session_element_element(session_id, element_id):
         return json.dumps({'value': {'error': 'invalid argument'}}), 404, {'content-type': 'application/json'}
 
     start = session.elements[element_id]
-    if not start:  # browsing context (no longer) valid
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
-
     results = locator(session, strategy, selector, start)
 
     if not results:
@@ -565,11 +1104,8 @@ def session_element_element(session_id, element_id):
     return json.dumps({'value': {'element-6066-11e4-a52e-4f735466cecf': unique_id}}), 200, {'content-type': 'application/json'}
 
 @app.route('/session/<session_id>/element/<element_id>/elements', methods=['POST'])
-def session_element_elements(session_id, element_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_element_elements(session, element_id):
     blob = json.loads(request.data)
     strategy = blob['using']
     selector = blob['value']
@@ -577,9 +1113,6 @@ def session_element_elements(session_id, element_id):
         return json.dumps({'value': {'error': 'invalid argument'}}), 404, {'content-type': 'application/json'}
 
     start = session.elements[element_id]
-    if not start:  # browsing context (no longer) valid
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
-
     results = locator(session, strategy, selector, start, findAll = True)
 
     if not results:
@@ -594,15 +1127,9 @@ def session_element_elements(session_id, element_id):
     return json.dumps({'value': serializations}), 200, {'content-type': 'application/json'}
 
 @app.route('/session/<session_id>/element/<element_id>/value', methods=['POST'])
-def session_element_value(session_id, element_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_element_value(session, element_id):
     element = session.elements[element_id]
-    if not element:
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
-
     blob = json.loads(request.data)
     text = blob['text']
 
@@ -619,21 +1146,17 @@ def session_element_value(session_id, element_id):
         for i in range(0, action.nActions):
             if action.getName(i) == 'SetFocus':
                 processed = True
-                action.doAction(i)
-                time.sleep(EVENTLOOP_TIME) # give the focus time to apply
-                generate_keyboard_event_text(text)
+                focus_element(action, i, element)
+                generate_keyboard_event_text(text, element)
                 break
         if not processed:
             raise RuntimeError("element's actions list didn't contain SetFocus. The element may be malformed")
-        return json.dumps({'value': None}), 404, {'content-type': 'application/json'}
+        return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/execute/sync', methods=['POST'])
-def session_execute(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_execute(session):
     blob = json.loads(request.data)
     script = cast(str, blob['script'])
     args = cast(list, blob['args'])
@@ -643,28 +1166,44 @@ def session_execute(session_id):
 
     match script:
         case "mobile: getClipboard":
-            content_type = cast(str, args[0]['contentType'] if 'contentType' in args else 'plaintext')
-            data = cast(str, get_clipboard(content_type))
-            return json.dumps({'value': base64.b64encode(data.encode('utf-8')).decode('utf-8')}), 200, {'content-type': 'application/json'}
+            content_type = cast(str, args[0].get('contentType', 'plaintext') if args else 'plaintext')
+            return Response(base64_json_value(get_clipboard(content_type)), 200, {'content-type': 'application/json'})
         case "mobile: setClipboard":
             content = args[0]['content']
-            content_type = cast(str, args[0]['contentType'])
-            set_clipboard(content, content_type)
+            content_type = cast(str, args[0].get('contentType', 'plaintext'))
+            set_clipboard(base64_chunks(content), content_type)
+            return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
+        case "mobile: getElementProperties":
+            options = args[0]
+            result = element_properties(session, options['elements'], options['properties'])
+            return json.dumps({'value': result}), 200, {'content-type': 'application/json'}
+        case "mobile: waitForVisualStability":
+            options = args[0] if args else {}
+            result = wait_for_visual_stability(options.get('stableFor', 500), options.get('timeout', 10000), options.get('rect'))
+            return json.dumps({'value': result}), 200, {'content-type': 'application/json'}
+        case "mobile: measureInputLatency":
+            result = measure_input_latency(session, args[0])
+            return json.dumps({'value': result}), 200, {'content-type': 'application/json'}
+        case "mobile: burstScreenshots":
+            options = args[0] if args else {}
+            count = options.get('count', 10)
+            interval = options.get('interval', 0)
+            if not isinstance(count, int) or not 0 < count <= BURST_MAX_FRAMES or not isinstance(interval, int) or interval < 0:
+                message = f'count must be between 1 and {BURST_MAX_FRAMES}, interval at least 0'
+                return json.dumps({'value': {'error': 'invalid argument', 'message': message}}), 404, {'content-type': 'application/json'}
+            result = burst_screenshots(count, interval, options.get('encoding', 'png'))
+            return json.dumps({'value': result}), 200, {'content-type': 'application/json'}
+        case gesture if gesture in GESTURES:
+            perform_gesture(session, GESTURES[gesture], args[0] if args else {})
             return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
     return json.dumps({'value': {'error': 'no such command'}}), 404, {'content-type': 'application/json'}
 
 
 @app.route('/session/<session_id>/element/<element_id>/clear', methods=['POST'])
-def session_element_clear(session_id, element_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_element_clear(session, element_id):
     element = session.elements[element_id]
-    if not element:
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
-
     characterCount = element.queryText().characterCount
     try:
         textElement = element.queryEditableText()
@@ -677,14 +1216,13 @@ def session_element_clear(session_id, element_id):
         for i in range(0, action.nActions):
             if action.getName(i) == 'SetFocus':
                 processed = True
-                action.doAction(i)
-                time.sleep(EVENTLOOP_TIME) # give the focus time to apply
+                focus_element(action, i, element)
 
                 pseudo_text = ''
                 pseudo_text += '\ue010' # end
                 for _ in range(characterCount):
                     pseudo_text += '\ue003'  # backspace
-                generate_keyboard_event_text(pseudo_text)
+                generate_keyboard_event_text(pseudo_text, element)
                 break
         if not processed:
             raise RuntimeError("element's actions list didn't contain SetFocus. The element may be malformed")
@@ -692,17 +1230,12 @@ def session_element_clear(session_id, element_id):
 
 
 @app.route('/session/<session_id>/appium/device/app_state', methods=['POST'])
-def session_appium_device_app_state(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_appium_device_app_state(session):
     blob = json.loads(request.data)
     appId = blob['appId']
 
-    proc = subprocess.Popen(
-        'selenium-webdriver-at-spi-appidlister', stdout=subprocess.PIPE)
-    out, err = proc.communicate()
+    out = run_helper(['selenium-webdriver-at-spi-appidlister'], stdout=subprocess.PIPE).stdout
 
     apps = json.loads(out)
     if appId in apps.values():
@@ -712,17 +1245,12 @@ def session_appium_device_app_state(session_id):
 
 
 @app.route('/session/<session_id>/appium/device/terminate_app', methods=['POST'])
-def session_appium_device_terminate_app(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_appium_device_terminate_app(session):
     blob = json.loads(request.data)
     appId = blob['appId']
 
-    proc = subprocess.Popen(
-        'selenium-webdriver-at-spi-appidlister', stdout=subprocess.PIPE)
-    out, err = proc.communicate()
+    out = run_helper(['selenium-webdriver-at-spi-appidlister'], stdout=subprocess.PIPE).stdout
 
     apps = json.loads(out)
     if appId in apps.values():
@@ -732,11 +1260,8 @@ def session_appium_device_terminate_app(session_id):
 
 
 @app.route('/session/<session_id>/appium/device/press_keycode', methods=['POST'])
-def session_appium_device_press_keycode(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_appium_device_press_keycode(session):
     blob = json.loads(request.data)
     keycode = blob['keycode']
     # Not doing anything with these for now
@@ -747,83 +1272,139 @@ def session_appium_device_press_keycode(session_id):
     return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
 
-@app.route('/session/<session_id>/actions', methods=['POST'])
-def session_actions(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
+def run_inputsynth(blob):
+    if 'KWIN_PID' not in os.environ:
+        raise RuntimeError("actions only work with nested kwin, or with the parent kwin pid passed in to KWIN_PID manually!")
+    with tempfile.NamedTemporaryFile() as file:
+        file.write(cbor.dumps(blob))
+        file.flush()
+        with holding_input():
+            run_helper(["selenium-webdriver-at-spi-inputsynth", file.name])
+
+
+# Gestures the inputsynth generates itself from a few parameters, see GestureAction
+GESTURES = {
+    "mobile: pinchGesture": 'pinch',
+    "mobile: rotateGesture": 'rotate',
+    "mobile: swipeGesture": 'swipe',
+    "mobile: flingGesture": 'fling',
+}
+
+
+def perform_gesture(session, kind, options):
+    gesture = dict(options, type=kind)
+    if 'elementId' in gesture:
+        # Centered on the element unless told otherwise
+        component = session.elements[gesture.pop('elementId')].queryComponent()
+        x, y = component.getPosition(pyatspi.XY_SCREEN)
+        width, height = component.getSize()
+        gesture.setdefault('x', x + width // 2)
+        gesture.setdefault('y', y + height // 2)
+    run_inputsynth({'actions': [{'type': 'gesture', 'id': 'gesture', 'actions': [gesture]}]})
+
 
+@app.route('/session/<session_id>/actions', methods=['POST'])
+@session_locked
+def session_actions(session):
     blob = json.loads(request.data)
+    resolve_origins(session, blob)
+    run_inputsynth(blob)
+    return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
+
 
+def resolve_origins(session, blob):
     """
     The following is to support actions that use a specific element
     as the origin. Instead of passing that origin to the inputsynth,
     we instead immediately transform from the coordinate system of the
     element to the viewport one, and then we pass that to the inputsynth.
     """
-    try:
-        for parent_action in blob["actions"]:
-            for action in parent_action["actions"]:
-                if not ("origin" in action and isinstance(action["origin"], dict)):
-                    continue
-                element_id = next(iter(action["origin"].values()))
-                action["origin"] = "viewport"
-                element = session.elements[element_id]
-                x, y = element.queryComponent().getPosition(pyatspi.XY_SCREEN)
-                action["x"] += x
-                action["y"] += y
-    except KeyError:
-        pass
-
-    if 'KWIN_PID' in os.environ:
-        with tempfile.NamedTemporaryFile() as file:
-            file.write(bytes(json.dumps(blob), "utf-8"))
-            file.flush()
-            subprocess.run(["selenium-webdriver-at-spi-inputsynth", file.name])
-    else:
-        raise RuntimeError("actions only work with nested kwin, or with the parent kwin pid passed in to KWIN_PID manually!")
-
-    return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
+    for parent_action in blob.get("actions", []):
+        for action in parent_action.get("actions", []):
+            if not ("origin" in action and isinstance(action["origin"], dict)):
+                continue
+            element_id = next(iter(action["origin"].values()), None)
+            action["origin"] = "viewport"
+            # Unknown or evicted elements raise NoSuchElementError, the click must not land elsewhere
+            element = session.elements[element_id]
+            x, y = element.queryComponent().getPosition(pyatspi.XY_SCREEN)
+            action["x"] = action.get("x", 0) + x
+            action["y"] = action.get("y", 0) + y
+
+
+def measure_input_latency(session, options):
+    # Performs the actions repetitions times and measures until the first frame showing a reaction, in rect if given.
+    # Returns the latency distribution in ms as the frame watcher reports it.
+    blob = {'actions': options['actions']}
+    resolve_origins(session, blob)
+    args = ['selenium-webdriver-at-spi-framewatcher', '--repetitions', str(int(options.get('repetitions', 20))),
+            '--stable-for', str(int(options.get('settle', 300))), '--timeout', str(int(options.get('timeout', 5000)))]
+    if rect := options.get('rect'):
+        args += ['--region', f"{int(rect['x'])},{int(rect['y'])},{int(rect['width'])},{int(rect['height'])}"]
+    with tempfile.NamedTemporaryFile() as file, holding_input():
+        file.write(cbor.dumps(blob))
+        file.flush()
+        proc = run_helper(args + ['--latency', file.name], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if proc.returncode != 0:
+        raise RuntimeError(f'measuring the input latency failed: {proc.stderr.decode("utf-8", errors="replace")}')
+    return json.loads(proc.stdout)
 
 
 @app.route('/session/<session_id>/appium/device/get_clipboard', methods=['POST'])
-def session_appium_device_get_clipboard(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_appium_device_get_clipboard(session):
     blob = json.loads(request.data)
-    contentType = blob['contentType']
-    data = cast(str, get_clipboard(contentType))
+    contentType = blob.get('contentType', 'plaintext')
 
-    return json.dumps({'value': base64.b64encode(data.encode('utf-8')).decode('utf-8')}), 200, {'content-type': 'application/json'}
+    return Response(base64_json_value(get_clipboard(contentType)), 200, {'content-type': 'application/json'})
 
 
 @app.route('/session/<session_id>/appium/device/set_clipboard', methods=['POST'])
-def session_appium_device_set_clipboard(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_appium_device_set_clipboard(session):
     blob = json.loads(request.data)
-    contentType = blob['contentType']
+    contentType = blob.get('contentType', 'plaintext')
     content = blob['content']
 
-    set_clipboard(content, contentType)
+    set_clipboard(base64_chunks(content), contentType)
 
     return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
 
-@app.route('/session/<session_id>/appium/element/<element_id>/value', methods=['POST'])
-def session_appium_element_value(session_id, element_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
+# Raw clipboard transfer for payloads too large to comfortably go through base64 and JSON. The body is the content
+# itself, streamed in both directions. contentType takes the Appium content types as well as MIME types; when setting,
+# the MIME type of the request body is used in its absence.
+@app.route('/session/<session_id>/appium/device/clipboard', methods=['GET'])
+@session_locked
+def session_appium_device_clipboard_get(session):
+    content_type = request.args.get('contentType', 'plaintext')
+    mime_types = clipboard_mime_types(content_type)
+
+    return Response(get_clipboard(content_type), 200, {'content-type': mime_types[0]})
+
+
+@app.route('/session/<session_id>/appium/device/clipboard', methods=['PUT'])
+@session_locked
+def session_appium_device_clipboard_put(session):
+    content_type = request.args.get('contentType', request.mimetype or 'plaintext')
+    set_clipboard(iter(lambda: request.stream.read(CLIPBOARD_CHUNK_SIZE), b''), content_type)
+
+    return json.dumps({'value': None}), 200, {'content-type': 'application/json'}
 
-    element = session.elements[element_id]
-    if not element:
-        return json.dumps({'value': {'error': 'no such element'}}), 404, {'content-type': 'application/json'}
 
+@app.route('/session/<session_id>/appium/device/clipboard/types', methods=['GET'])
+@session_locked
+def session_appium_device_clipboard_types(session):
+    if not clipboard_helper_available():
+        raise RuntimeError('listing clipboard types needs selenium-webdriver-at-spi-clipboard')
+
+    return json.dumps({'value': clipboard_offered_types()}), 200, {'content-type': 'application/json'}
+
+
+@app.route('/session/<session_id>/appium/element/<element_id>/value', methods=['POST'])
+@session_locked
+def session_appium_element_value(session, element_id):
+    element = session.elements[element_id]
     blob = json.loads(request.data)
     value = blob['text']
 
@@ -836,19 +1417,15 @@ def session_appium_element_value(session_id, element_id):
 
 
 @app.route('/session/<session_id>/screenshot', methods=['GET'])
-def session_appium_screenshot(session_id):
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
+@session_locked
+def session_appium_screenshot(session):
     # NB: these values incorrectly do not include the device pixel ratio, so they are off when used on a scaling display
     # position_x, position_y = session.browsing_context.getChildAtIndex(0).queryComponent().getPosition(pyatspi.XY_SCREEN)
     # size_width, size_height = session.browsing_context.getChildAtIndex(0).queryComponent().getSize()
 
-    proc = subprocess.Popen(['selenium-webdriver-at-spi-screenshotter',
-                             str(0), str(0), str(0), str(0)],
-                            stdout=subprocess.PIPE)
-    out, err = proc.communicate()
+    proc = run_helper(['selenium-webdriver-at-spi-screenshotter', str(0), str(0), str(0), str(0)],
+                      stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    out, err = proc.stdout, proc.stderr.decode('utf-8', errors='replace')
 
     if not out:
         return json.dumps({'value': {'error': err}}), 404, {'content-type': 'application/json'}
@@ -856,26 +1433,147 @@ def session_appium_screenshot(session_id):
     return json.dumps({'value': out.decode('utf-8')}), 200, {'content-type': 'application/json'}
 
 
+def burst_screenshots(count, interval, encoding='png'):
+    # Takes count screenshots, one every interval ms or as fast as the compositor delivers them for 0. All in one
+    # screenshotter run, which encodes only once all frames are captured, so the frames are as close together as they
+    # get. Returns the frames in order with their time in ms since the first one. encoding may also be qoi or raw,
+    # which are much cheaper to produce than PNG.
+    proc = run_helper(['selenium-webdriver-at-spi-screenshotter', '--burst', str(int(count)), '--interval', str(int(interval)),
+                       '--encoding', encoding], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if proc.returncode != 0:
+        raise RuntimeError(f'burst screenshots failed: {proc.stderr.decode("utf-8", errors="replace")}')
+    frames = [line.split(b' ', 1) for line in proc.stdout.splitlines() if line]
+    if not frames:
+        return []
+    first = int(frames[0][0])
+    return [{'timestamp': (int(timestamp) - first) / 1000, 'image': image.decode('ascii')} for timestamp, image in frames]
+
+
+@app.route('/session/<session_id>/appium/wait_for_visual_stability', methods=['POST'])
+@session_locked
+def session_appium_wait_for_visual_stability(session):
+    blob = json.loads(request.data) if request.data else {}
+    result = wait_for_visual_stability(blob.get('stableFor', 500), blob.get('timeout', 10000), blob.get('rect'))
+    return json.dumps({'value': result}), 200, {'content-type': 'application/json'}
+
+
+def wait_for_visual_stability(stable_for, timeout, rect=None):
+    # Returns once nothing got painted (in rect, if given) for stable_for ms, or after timeout ms. The frame watcher
+    # looks at the screencast stream, so there is no polling and we return as soon as the screen is quiet.
+    start = time.monotonic()
+    deadline = start + timeout / 1000
+    args = ['selenium-webdriver-at-spi-framewatcher', '--stable-for', str(int(stable_for)), '--timeout', str(int(timeout))]
+    if rect:
+        args += ['--region', f"{int(rect['x'])},{int(rect['y'])},{int(rect['width'])},{int(rect['height'])}"]
+    try:
+        proc = run_helper(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        if proc.returncode == 0:
+            return json.loads(proc.stdout)
+        print(f'framewatcher failed, falling back to screenshots: {proc.stderr.decode("utf-8", errors="replace")}')
+    except FileNotFoundError:
+        pass
+
+    # Without screencasting compare screenshots instead, for what is left of the timeout should the frame watcher
+    # have failed late. Much coarser, every poll is a screenshot.
+    previous = None
+    stable_since = time.monotonic()
+    frames = changes = 0
+    while True:
+        now = time.monotonic()
+        if now - stable_since >= stable_for / 1000 or now >= deadline:
+            break
+        # Only compared for equality, so skip encoding altogether
+        shot = run_helper(['selenium-webdriver-at-spi-screenshotter', '--encoding', 'raw'], stdout=subprocess.PIPE).stdout
+        if rect:
+            shot = crop_raw_screenshot(shot, rect)
+        frames += 1
+        if shot != previous:
+            if previous is not None:
+                changes += 1
+            previous = shot
+            stable_since = time.monotonic()
+        with atspi_lock.released():
+            tracing.sleep(min(EVENTLOOP_TIME, max(0, deadline - time.monotonic())))
+    now = time.monotonic()
+    return {'stable': now - stable_since >= stable_for / 1000, 'elapsed': int((now - start) * 1000), 'frames': frames,
+            'changes': changes, 'lastChange': int((stable_since - start) * 1000)}
+
+
+def crop_raw_screenshot(shot, rect):
+    # The pixels in rect of a base64 raw screenshot (see the screenshotter's encoder): 'SWRW', then width, height,
+    # bytes per line and QImage::Format as little endian 32 bit, then the pixel data.
+    data = base64.b64decode(shot)
+    if len(data) < 20 or data[:4] != b'SWRW':
+        return data
+    width, height, bytes_per_line, _format = struct.unpack_from('<4I', data, 4)
+    pixel_size = bytes_per_line // width if width else 0
+    left = min(max(int(rect['x']), 0), width)
+    right = min(max(int(rect['x'] + rect['width']), left), width)
+    top = min(max(int(rect['y']), 0), height)
+    bottom = min(max(int(rect['y'] + rect['height']), top), height)
+    return b''.join(data[20 + y * bytes_per_line + left * pixel_size:20 + y * bytes_per_line + right * pixel_size]
+                    for y in range(top, bottom))
+
+
 @app.route('/session/<session_id>/appium/compare_images', methods=['POST'])
-def session_appium_compare_images(session_id):
+@session_locked
+def session_appium_compare_images(session):
     """
     Reference:
     - https://github.com/appium/python-client/blob/master/appium/webdriver/extensions/images_comparison.py
     - https://github.com/appium/appium/blob/master/packages/opencv/lib/index.js
     """
-    session = sessions[session_id]
-    if not session:
-        return json.dumps({'value': {'error': 'no such window'}}), 404, {'content-type': 'application/json'}
-
     blob = json.loads(request.data)
     mode: str = blob['mode']
     options: dict = blob['options']
     return_value: dict = {}
 
+    image1 = base64.b64decode(blob['firstImage'])
+    image2 = base64.b64decode(blob['secondImage'])
+
+    if mode == 'matchTemplate':
+        threshold: float = options.get('threshold', 0.0)  # Exact match
+        args = ['--threshold', repr(threshold)]
+        # Not in appium: roi limits the search to a rect of the first image (e.g. where the element is expected), and
+        # exhaustive disables the coarse-to-fine search in favor of trying every position on full resolution.
+        roi: dict | None = options.get('roi')
+        if roi:
+            args += ['--roi', f"{int(roi['x'])},{int(roi['y'])},{int(roi['width'])},{int(roi['height'])}"]
+        if options.get('exhaustive', False):
+            args.append('--exhaustive')
+        result = native_compare_images('template', image1, image2, args)
+        if result is not None:
+            if not result['found']:
+                return json.dumps({'value': {'error': 'Cannot find any occurrences of the partial image in the full image.'}}), 404, {'content-type': 'application/json'}
+            return json.dumps({'value': {'rect': result['rect']}}), 200, {'content-type': 'application/json'}
+    elif mode == 'getSimilarity':
+        result = native_compare_images('similarity', image1, image2)
+        if result is not None:
+            return json.dumps({'value': {'score': 1.0 - result['score']}}), 200, {'content-type': 'application/json'}
+        # else: the helper also fails on differently sized images, let OpenCV produce the error
+    elif mode == 'getChangedRegions':
+        # Not an appium mode. Compares the second image against the first (the baseline) in tiles and returns the
+        # rectangles that changed; with firstOnly it stops at the first change when all you need is a yes or no.
+        tile_size = int(options.get('tileSize', 32))
+        args = ['--tile-size', str(tile_size), '--tolerance', str(int(options.get('tolerance', 0)))]
+        if options.get('firstOnly', False):
+            args.append('--first-only')
+        cache = None
+        if options.get('cacheBaseline', True):
+            key = hashlib.sha256(image1).hexdigest()
+            cache = os.path.join(tile_hash_cache_dir(), f'{key}-{tile_size}.tilehashes')
+            args += ['--baseline-cache', cache]
+        result = native_compare_images('tiles', image1, image2, args)
+        if cache:
+            prune_tile_hash_cache(cache)
+        if result is None:
+            return json.dumps({'value': {'error': 'getChangedRegions requires selenium-webdriver-at-spi-imagecompare'}}), 404, {'content-type': 'application/json'}
+        return json.dumps({'value': {'changed': result['changed'], 'rects': result['rects']}}), 200, {'content-type': 'application/json'}
+
     import cv2 as cv  # The extension is slow, so load it on demand
 
-    cv_image1 = cv.imdecode(np.frombuffer(base64.b64decode(blob['firstImage']), np.uint8), cv.IMREAD_COLOR)
-    cv_image2 = cv.imdecode(np.frombuffer(base64.b64decode(blob['secondImage']), np.uint8), cv.IMREAD_COLOR)
+    cv_image1 = cv.imdecode(np.frombuffer(image1, np.uint8), cv.IMREAD_COLOR)
+    cv_image2 = cv.imdecode(np.frombuffer(image2, np.uint8), cv.IMREAD_COLOR)
 
     if mode == 'matchFeatures':
         # https://docs.opencv.org/3.0-beta/doc/py_tutorials/py_feature2d/py_matcher/py_matcher.html
@@ -929,12 +1627,18 @@ def session_appium_compare_images(session_id):
 
     elif mode == 'matchTemplate':
         threshold: float = options.get('threshold', 0.0)  # Exact match
+        roi_x, roi_y = 0, 0
+        if roi:
+            roi_x, roi_y = max(0, int(roi['x'])), max(0, int(roi['y']))
+            cv_image1 = cv_image1[roi_y:max(roi_y, int(roi['y']) + int(roi['height'])), roi_x:max(roi_x, int(roi['x']) + int(roi['width']))]
+            if cv_image1.shape[0] < cv_image2.shape[0] or cv_image1.shape[1] < cv_image2.shape[1]:
+                return json.dumps({'value': {'error': 'Cannot find any occurrences of the partial image in the full image.'}}), 404, {'content-type': 'application/json'}
 
         matched = cv.matchTemplate(cv_image1, cv_image2, cv.TM_SQDIFF_NORMED)
         min_val, max_val, min_loc, max_loc = cv.minMaxLoc(matched)
 
         if min_val <= threshold:
-            x, y = min_loc
+            x, y = min_loc[0] + roi_x, min_loc[1] + roi_y
             return_value['rect'] = {
                 'x': x,
                 "y": y,
@@ -957,6 +1661,61 @@ def session_appium_compare_images(session_id):
     return json.dumps({'value': return_value}), 200, {'content-type': 'application/json'}
 
 
+def tile_hash_cache_dir():
+    # Tile hashes of baselines, so comparing against the same baseline again only needs to hash the new image.
+    directory = os.getenv('SELENIUM_TILE_HASH_CACHE',
+                          os.path.join(os.getenv('XDG_CACHE_HOME', os.path.expanduser('~/.cache')), 'selenium-webdriver-at-spi', 'tilehashes'))
+    os.makedirs(directory, exist_ok=True)
+    return directory
+
+
+def prune_tile_hash_cache(used):
+    # Marks used as recently used and drops the least recently used tile hashes beyond TILE_HASH_CACHE_SIZE. Workers of
+    # a pool keep the cache across tests, without a bound it would grow with every baseline ever compared against.
+    try:
+        os.utime(used)
+    except FileNotFoundError:
+        pass
+    directory = os.path.dirname(used)
+    entries = []
+    with os.scandir(directory) as iterator:
+        for entry in iterator:
+            try:
+                stat = entry.stat()
+            except FileNotFoundError:
+                continue
+            entries.append((stat.st_mtime, stat.st_size, entry.path))
+    total = sum(size for _, size, _ in entries)
+    for _, size, path in sorted(entries):
+        if total <= TILE_HASH_CACHE_SIZE:
+            break
+        try:
+            os.remove(path)
+        except FileNotFoundError:
+            pass  # someone else pruned it
+        total -= size
+
+
+def native_compare_images(mode, image1, image2, args=()):
+    # Runs the comparison through selenium-webdriver-at-spi-imagecompare, which spares us importing OpenCV and is
+    # vectorized. Returns None when the helper isn't available or can't handle the input, so the caller can fall back
+    # to OpenCV.
+    with tempfile.TemporaryDirectory(prefix='selenium-compare') as directory:
+        paths = [os.path.join(directory, 'first'), os.path.join(directory, 'second')]
+        for path, image in zip(paths, [image1, image2]):
+            with open(path, 'wb') as file:
+                file.write(image)
+        try:
+            proc = run_helper(['selenium-webdriver-at-spi-imagecompare', '--mode', mode, *args, *paths],
+                              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        except FileNotFoundError:
+            return None
+    if proc.returncode != 0:
+        print(f'imagecompare failed, falling back to OpenCV: {proc.stderr.decode("utf-8", errors="replace")}')
+        return None
+    return json.loads(proc.stdout)
+
+
 def calculate_matched_rect(matched_points: list[tuple[int, int]]) -> dict[str, int]:
     if len(matched_points) < 2:
         return {
@@ -978,21 +1737,46 @@ def calculate_matched_rect(matched_points: list[tuple[int, int]]) -> dict[str, i
     }
 
 
-def generate_keyboard_event_text(text):
-    # using a nested kwin. need to synthesize keys into wayland (not supported in atspi right now)
+def generate_keyboard_event_text(text, element=None):
+    # element, if known, is the one receiving the text. using a nested kwin. need to synthesize keys into wayland (not supported in atspi right now)
     if 'KWIN_PID' in os.environ:
-        with tempfile.NamedTemporaryFile() as fp:
-            actions = []
-            for ch in text:
-                actions.append({'type': 'keyDown', 'value': ch})
-                actions.append({'type': 'keyUp', 'value': ch})
-            fp.write(json.dumps({'actions': [{'type': 'key', 'id': 'key', 'actions': actions}]}).encode())
-            fp.flush()
-            subprocess.run(["selenium-webdriver-at-spi-inputsynth", fp.name])
-    else:
+        # Runs of printable text are committed as a whole through the input method run.rb has KWin start, anything
+        # else (selenium keys, return...) needs to be actual keys. Without the input method the text gets typed.
+        actions = []
         for ch in text:
-            pyatspi.Registry.generateKeyboardEvent(char_to_keyval(ch), None, pyatspi.KEY_SYM)
-            time.sleep(EVENTLOOP_TIME)
+            if ch.isprintable() and ch not in SPECIAL_KEYVALS:
+                if actions and actions[-1]['type'] == 'text':
+                    actions[-1]['value'] += ch
+                else:
+                    actions.append({'type': 'text', 'value': ch})
+                continue
+            actions.append({'type': 'keyDown', 'value': ch})
+            actions.append({'type': 'keyUp', 'value': ch})
+        run_inputsynth({'actions': [{'type': 'key', 'id': 'key', 'actions': actions}]})
+    else:
+        # The registry only returns from generateKeyboardEvent once it has injected the key, so we send one key after
+        # the other without pause. The application confirms the keys it got through text insertion events. We stay at
+        # most TYPING_WINDOW characters ahead of it, so a busy application doesn't get flooded. Not every target sends
+        # insertion events (terminals, canvases, widgets acting on keys, text in another accessible than element), so
+        # once confirmations fail to come in time we stop waiting for them for the rest of the text. Keys without text
+        # (e.g. backspace) can't be confirmed, a final round trip makes sure the application got to them too.
+        keyvals = [char_to_keyval(ch) for ch in text]
+        with holding_input(), TextInsertionCounter(element, TYPING_TIMEOUT) as counter:
+            expected = 0
+            confirming = True
+            for ch, keyval in zip(text, keyvals):
+                with tracing.span('atspi', 'generateKeyboardEvent'):
+                    pyatspi.Registry.generateKeyboardEvent(keyval, None, pyatspi.KEY_SYM)
+                if ch.isprintable():
+                    expected += 1
+                if confirming and expected - counter.seen > TYPING_WINDOW:
+                    confirming = counter.wait_for(expected - TYPING_WINDOW)
+            if confirming and not counter.wait_for(expected):
+                confirming = False
+            if not confirming:
+                print(f'typed {expected} characters but only saw {counter.seen} arrive, continuing regardless')
+            counter.probe()
+
 
 def keyval_to_keycode(keyval):
     keymap = Gdk.Keymap.get_default()
@@ -1003,38 +1787,174 @@ def keyval_to_keycode(keyval):
     return keys[0]
 
 
+# Selenium special keys by their keyval.
+# https://www.cl.cam.ac.uk/~mgk25/ucs/keysymdef.h
+SPECIAL_KEYVALS = {
+    "\uE00C": 0xff1b, # escape
+    "\ue03d": 0xffeb, # left meta
+    "\ue006": 0xff0d, # return
+    "\ue007": 0xff8d, # enter
+    "\ue003": 0xff08, # backspace
+    "\ue010": 0xff57, # end
+    "\ue012": 0xff51, # left
+    "\ue014": 0xff53, # right
+    "\ue013": 0xff52, # up
+    "\ue015": 0xff54, # down
+    "\ue004": 0xff09, # tab
+}
+
+
+@functools.cache
 def char_to_keyval(ch):
-    keyval = Gdk.unicode_to_keyval(ord(ch))
-    # I Don't know why this doesn't work, also doesn't work with \033 as input. :((
+    # I Don't know why unicode_to_keyval doesn't work for the special keys, also doesn't work with \033 as input. :((
     # https://gitlab.gnome.org/GNOME/gtk/-/blob/gtk-3-24/gdk/gdkkeyuni.c
-    # Other useful resources:
-    # https://www.cl.cam.ac.uk/~mgk25/ucs/keysymdef.h
-    if ch == "\uE00C":
-        keyval = 0xff1b # escape
-    elif ch == "\ue03d":
-        keyval = 0xffeb # left meta
-    elif ch == "\ue006":
-        keyval = 0xff0d # return
-    elif ch == "\ue007":
-        keyval = 0xff8d # enter
-    elif ch == "\ue003":
-        keyval = 0xff08 # backspace
-    elif ch == "\ue010":
-        keyval = 0xff57 # end
-    elif ch == "\ue012":
-        keyval = 0xff51 # left
-    elif ch == "\ue014":
-        keyval = 0xff53 # right
-    elif ch == "\ue013":
-        keyval = 0xff52 # up
-    elif ch == "\ue015":
-        keyval = 0xff54 # down
-    elif ch == "\ue004":
-        keyval = 0xff09 # tab
-    return keyval
+    if ch in SPECIAL_KEYVALS:
+        return SPECIAL_KEYVALS[ch]
+    return Gdk.unicode_to_keyval(ord(ch))
+
+
+# Processes of the clipboard helper that serve a selection we set. They exit by themselves once something else
+# becomes the selection.
+clipboard_owners = []
+clipboard_owners_lock = threading.Lock()
+
+# The spellings of plain text toolkits look for
+TEXT_MIME_TYPES = ['text/plain;charset=utf-8', 'text/plain', 'UTF8_STRING', 'TEXT', 'STRING']
+# Appium content types and the MIME types they are exchanged as. Anything with a slash is taken to be a MIME type.
+CLIPBOARD_CONTENT_TYPES = {
+    'plaintext': TEXT_MIME_TYPES,
+    'image': ['image/png'],
+    'url': ['text/uri-list'],
+    'html': ['text/html'],
+}
+# Clipboard data only ever passes through the driver in pieces of this size. A multiple of three so base64 of
+# consecutive pieces concatenates.
+CLIPBOARD_CHUNK_SIZE = 48 * 1024
+
+
+def clipboard_mime_types(content_type):
+    if '/' in content_type:
+        return [content_type]
+    if content_type not in CLIPBOARD_CONTENT_TYPES:
+        raise ValueError(f'content type {content_type} not supported')
+    return CLIPBOARD_CONTENT_TYPES[content_type]
+
+
+@functools.cache
+def clipboard_helper_available():
+    # selenium-webdriver-at-spi-clipboard talks the wlr data control protocol and so neither needs a window nor focus.
+    # It is usable when it exists and the compositor lets it bind the protocol.
+    try:
+        proc = run_helper(['selenium-webdriver-at-spi-clipboard', 'list'], stdout=subprocess.DEVNULL)
+    except FileNotFoundError:
+        return False
+    return proc.returncode in (0, 2)  # 2 is an empty selection
+
+
+def clipboard_offered_types():
+    proc = run_helper(['selenium-webdriver-at-spi-clipboard', 'list'], stdout=subprocess.PIPE)
+    if proc.returncode == 2:
+        return []
+    if proc.returncode != 0:
+        raise RuntimeError('clipboard helper failed to list the selection')
+    return proc.stdout.decode('utf-8').splitlines()
+
+
+def native_get_clipboard(mime_types):
+    # Streams the selection as the first of mime_types it offers. Returns an iterator over chunks of the data, which
+    # is empty if there is nothing (of those types) selected.
+    args = ['selenium-webdriver-at-spi-clipboard', 'get']
+    for mime_type in mime_types:
+        args += ['--mime-type', mime_type]
+    with tracing.span('spawn', 'selenium-webdriver-at-spi-clipboard'):
+        proc = subprocess.Popen(args, stdout=subprocess.PIPE)
+    # Waiting for the first piece tells failures apart from data, before anyone starts sending a response.
+    with atspi_lock.released():
+        first = proc.stdout.read(CLIPBOARD_CHUNK_SIZE)
+        if not first:
+            proc.stdout.close()
+            if proc.wait() not in (0, 2):
+                raise RuntimeError('clipboard helper failed to read the selection')
+            return iter(())
+
+    def chunks():
+        try:
+            yield first
+            while chunk := proc.stdout.read(CLIPBOARD_CHUNK_SIZE):
+                yield chunk
+        finally:
+            # Should the consumer stop early the helper fails its next write and quits
+            proc.stdout.close()
+            proc.wait()
+
+    return chunks()
+
+
+def native_set_clipboard(chunks, mime_types):
+    # Hands the data to a clipboard helper, which spools it and stays around serving it as the selection. Returns once
+    # the selection is set.
+    with atspi_lock.released(), clipboard_owners_lock:
+        clipboard_owners[:] = [owner for owner in clipboard_owners if owner.poll() is None]
+        args = ['selenium-webdriver-at-spi-clipboard', 'set']
+        for mime_type in mime_types:
+            args += ['--mime-type', mime_type]
+        with tracing.span('spawn', 'selenium-webdriver-at-spi-clipboard'):
+            proc = subprocess.Popen(args, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        try:
+            for chunk in chunks:
+                proc.stdin.write(chunk)
+            proc.stdin.close()
+        except BrokenPipeError:
+            pass
+        ready = proc.stdout.readline().strip() == b'ready'
+        proc.stdout.close()
+        if not ready:
+            proc.wait()
+            raise RuntimeError('clipboard helper failed to set the selection')
+        clipboard_owners.append(proc)
+
+
+def base64_chunks(content):
+    # Decodes base64 piecewise, every four characters are three bytes. Line breaks of MIME style base64 don't count,
+    # so characters short of a multiple of four are carried over to the next piece.
+    step = CLIPBOARD_CHUNK_SIZE // 3 * 4
+    rest = ''
+    for offset in range(0, len(content), step):
+        piece = rest + ''.join(content[offset:offset + step].split())
+        cut = len(piece) - len(piece) % 4
+        if cut:
+            yield base64.b64decode(piece[:cut])
+        rest = piece[cut:]
+    if rest:
+        yield base64.b64decode(rest)  # incomplete, let it raise
+
+
+def base64_json_value(chunks):
+    # Produces {"value": "<base64 of chunks>"} without ever holding more than a chunk of the data
+    yield b'{"value": "'
+    rest = b''
+    for chunk in chunks:
+        chunk = rest + chunk
+        cut = len(chunk) - len(chunk) % 3
+        yield base64.b64encode(chunk[:cut])
+        rest = chunk[cut:]
+    yield base64.b64encode(rest)
+    yield b'"}'
 
 
 def get_clipboard(content_type):
+    # Returns an iterator over chunks of the clipboard content
+    mime_types = clipboard_mime_types(content_type)
+    if clipboard_helper_available():
+        return native_get_clipboard(mime_types)
+    if content_type != 'plaintext':
+        raise ValueError(f'content type {content_type} needs selenium-webdriver-at-spi-clipboard')
+    with atspi_lock:
+        data = _get_clipboard(content_type)
+    return iter([data.encode('utf-8')] if data else [])
+
+
+def _get_clipboard(content_type):
     # NOTE: need a window because on wayland we must be the active window to manipulate the clipboard (currently anyway)
     window = Gtk.Window()
     window.set_default_size(20, 20)
@@ -1057,7 +1977,19 @@ def get_clipboard(content_type):
     return data
 
 
-def set_clipboard(content, content_type):
+def set_clipboard(chunks, content_type):
+    # Sets the clipboard to the data of the chunks iterator
+    mime_types = clipboard_mime_types(content_type)
+    if clipboard_helper_available():
+        native_set_clipboard(chunks, mime_types)
+        return
+    if content_type != 'plaintext':
+        raise ValueError(f'content type {content_type} needs selenium-webdriver-at-spi-clipboard')
+    with atspi_lock:
+        _set_clipboard(b''.join(chunks).decode('utf-8'), content_type)
+
+
+def _set_clipboard(text, content_type):
     # NOTE: need a window because on wayland we must be the active window to manipulate the clipboard (currently anyway)
     window = Gtk.Window()
     window.set_default_size(20, 20)
@@ -1065,7 +1997,7 @@ def set_clipboard(content, content_type):
     clipboard = Gtk.Clipboard.get_for_display(display, Gdk.SELECTION_CLIPBOARD)
 
     if content_type == 'plaintext':
-        clipboard.set_text(base64.b64decode(content).decode('utf-8'), -1)
+        clipboard.set_text(text, -1)
     else:
         raise 'content type not currently supported'
 
@@ -1077,8 +2009,26 @@ def set_clipboard(content, content_type):
 
 
 def spin_glib_main_context(repeat: int = 4):
+    # Only the iterations need atspi_lock, other requests may go ahead while we sleep
     context = GLib.MainContext.default()
     for _ in range(repeat):
-        time.sleep(EVENTLOOP_TIME_LONG)
-        while context.pending():
-            context.iteration(may_block=False)
+        with atspi_lock.released():
+            tracing.sleep(EVENTLOOP_TIME_LONG)
+        with atspi_lock:
+            while context.pending():
+                context.iteration(may_block=False)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--port', type=int, default=int(os.environ.get('FLASK_PORT', '4723')))
+    args = parser.parse_args()
+
+    from werkzeug.serving import make_server
+    server = make_server('127.0.0.1', args.port, app, threaded=True)
+    # We are listening. Tell whoever started us (run.rb) through the fd they gave us, so they needn't poll /status.
+    if 'SELENIUM_READY_FD' in os.environ:
+        ready_fd = int(os.environ['SELENIUM_READY_FD'])
+        os.write(ready_fd, b'ready\n')
+        os.close(ready_fd)
+    server.serve_forever()
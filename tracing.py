@@ -0,0 +1,197 @@
+# SPDX-License-Identifier: AGPL-3.0-or-later
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+# Timing of what the driver spends its time on. Every span (a request, an at-spi call, a helper process, a sleep...)
+# feeds a histogram exported in Prometheus text format, and is appended to the trace of the session it happened in.
+# Traces are Chrome trace-event JSON (chrome://tracing, Perfetto) with timestamps on CLOCK_MONOTONIC, the same clock
+# the C++ helpers trace with, so their traces merge into one timeline.
+# https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+
+import collections
+import functools
+import json
+import os
+import threading
+import time
+from contextlib import contextmanager
+
+# Upper bounds of the histogram buckets, in seconds
+BUCKETS = (0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10)
+# A trace holds at most this many events, the oldest are dropped. Bounds the memory of long sessions.
+MAX_EVENTS = 100000
+# How many traces of sessions that went away are kept, so they may be fetched still. Those of open sessions always are.
+MAX_FINISHED_TRACES = 32
+METRIC = 'selenium_webdriver_at_spi_span_seconds'
+
+
+class Histogram:
+
+    def __init__(self) -> None:
+        self.buckets = [0] * len(BUCKETS)
+        self.count = 0
+        self.sum = 0.0
+
+    def observe(self, seconds):
+        for index, bound in enumerate(BUCKETS):
+            if seconds <= bound:
+                self.buckets[index] += 1
+                break
+        self.count += 1
+        self.sum += seconds
+
+
+lock = threading.Lock()
+histograms = {}  # (category, name) -> Histogram
+extra_metrics = []  # (name, type, help, callback) of metrics others provide
+traces = {}  # session id -> deque of trace events
+finished = collections.deque()  # ids of the sessions that went away but whose traces are kept, oldest first
+local = threading.local()  # session_id and start of the request the thread is serving
+
+
+def start_session(session_id):
+    with lock:
+        traces[session_id] = collections.deque(maxlen=MAX_EVENTS)
+    bind_session(session_id)
+
+
+def bind_session(session_id):
+    # Spans of this thread from now on go to the trace of session_id
+    local.session_id = session_id
+
+
+def begin_request(session_id):
+    local.session_id = session_id
+    local.request_start = time.monotonic_ns()
+
+
+def end_request(name):
+    start = getattr(local, 'request_start', None)
+    if start is not None:
+        record('request', name, start, time.monotonic_ns())
+    local.session_id = None
+    local.request_start = None
+
+
+@contextmanager
+def span(category, name, **args):
+    start = time.monotonic_ns()
+    try:
+        yield
+    finally:
+        record(category, name, start, time.monotonic_ns(), args)
+
+
+def traced(category, name=None):
+    # Decorator form of span
+    def decorator(func):
+        span_name = name or func.__name__
+
+        @functools.wraps(func)
+        def wrapper(*args, **kwargs):
+            with span(category, span_name):
+                return func(*args, **kwargs)
+        return wrapper
+    return decorator
+
+
+def sleep(seconds):
+    with span('sleep', 'sleep'):
+        time.sleep(seconds)
+
+
+def record(category, name, start_ns, end_ns, args=None):
+    session_id = getattr(local, 'session_id', None)
+    with lock:
+        key = (category, name)
+        if key not in histograms:
+            histograms[key] = Histogram()
+        histograms[key].observe((end_ns - start_ns) / 1e9)
+        trace = traces.get(session_id) if session_id else None
+        if trace is not None:
+            event = {'name': name, 'cat': category, 'ph': 'X', 'ts': start_ns // 1000, 'dur': (end_ns - start_ns) // 1000,
+                     'pid': os.getpid(), 'tid': threading.get_native_id()}
+            if args:
+                event['args'] = args
+            trace.append(event)
+
+
+def trace(session_id):
+    # The trace of session_id as trace-event document, None if there is none (anymore). Includes the traces of the
+    # helpers that ran for the session.
+    with lock:
+        events = traces.get(session_id)
+        if events is None:
+            return None
+        events = list(events)
+    metadata = {'name': 'process_name', 'ph': 'M', 'pid': os.getpid(), 'args': {'name': 'selenium-webdriver-at-spi'}}
+    return {'traceEvents': [metadata] + events + helper_events(session_id), 'displayTimeUnit': 'ms', 'otherData': {'session': session_id}}
+
+
+def helper_environment():
+    # The environment for helper processes. When traces are written to a directory the helpers trace too, into files
+    # named after the session they run for.
+    directory = os.environ.get('SELENIUM_TRACE_DIR')
+    session_id = getattr(local, 'session_id', None)
+    if not directory or not session_id:
+        return None
+    return dict(os.environ, SELENIUM_TRACE_SESSION=session_id)
+
+
+def helper_events(session_id):
+    directory = os.environ.get('SELENIUM_TRACE_DIR')
+    if not directory or not os.path.isdir(directory):
+        return []
+    events = []
+    for name in sorted(os.listdir(directory)):
+        if not name.startswith(f'{session_id}-') or name == f'{session_id}-driver.json':
+            continue
+        try:
+            with open(os.path.join(directory, name)) as file:
+                events += json.load(file).get('traceEvents', [])
+        except (OSError, ValueError) as e:
+            print(f'ignoring unreadable helper trace {name}: {e}')
+    return events
+
+
+def finish_session(session_id):
+    # With SELENIUM_TRACE_DIR set the trace is written there, next to the ones of the helpers
+    directory = os.environ.get('SELENIUM_TRACE_DIR')
+    document = trace(session_id) if directory else None
+    if document is not None:
+        os.makedirs(directory, exist_ok=True)
+        with open(os.path.join(directory, f'{session_id}-driver.json'), 'w') as file:
+            json.dump(document, file)
+    with lock:
+        if session_id in traces:
+            finished.append(session_id)
+        while len(finished) > MAX_FINISHED_TRACES:
+            traces.pop(finished.popleft(), None)
+
+
+def add_metric(name, metric_type, description, callback):
+    # Exports the value callback() returns with the metrics, e.g. a gauge
+    extra_metrics.append((name, metric_type, description, callback))
+
+
+def label(value):
+    return value.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def metrics():
+    # https://prometheus.io/docs/instrumenting/exposition_formats/
+    with lock:
+        snapshot = [(key, list(histogram.buckets), histogram.count, histogram.sum) for key, histogram in histograms.items()]
+    lines = [f'# HELP {METRIC} Time the driver spent in requests, at-spi calls, helper processes, waits and serialization.',
+             f'# TYPE {METRIC} histogram']
+    for (category, name), buckets, count, total in sorted(snapshot):
+        labels = f'category="{label(category)}",name="{label(name)}"'
+        cumulative = 0
+        for bound, bucket in zip(BUCKETS, buckets):
+            cumulative += bucket
+            lines.append(f'{METRIC}_bucket{{{labels},le="{bound}"}} {cumulative}')
+        lines.append(f'{METRIC}_bucket{{{labels},le="+Inf"}} {count}')
+        lines.append(f'{METRIC}_sum{{{labels}}} {total}')
+        lines.append(f'{METRIC}_count{{{labels}}} {count}')
+    for name, metric_type, description, callback in extra_metrics:
+        lines += [f'# HELP {name} {description}', f'# TYPE {name} {metric_type}', f'{name} {callback()}']
+    return '\n'.join(lines) + '\n'
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "tracing.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include <ctime>
+#include <unistd.h>
+
+namespace
+{
+struct Event {
+    char phase;
+    const char *category;
+    const char *name;
+    qint64 timestamp;
+    qint64 duration;
+    pid_t thread;
+    QJsonObject args;
+};
+
+// Collects the events in memory and writes them out when the process exits
+class Trace
+{
+public:
+    Trace() = default;
+
+    ~Trace()
+    {
+        write();
+    }
+
+    void append(Event &&event)
+    {
+        const std::lock_guard lock(m_mutex);
+        if (m_name.isEmpty() && QCoreApplication::instance()) {
+            m_name = QCoreApplication::applicationName();
+        }
+        m_events.push_back(std::move(event));
+    }
+
+    qint64 count(const char *name, qint64 increment)
+    {
+        const std::lock_guard lock(m_mutex);
+        return m_counters[name] += increment;
+    }
+
+    Q_DISABLE_COPY_MOVE(Trace)
+
+private:
+    void write()
+    {
+        const std::lock_guard lock(m_mutex);
+        if (m_events.empty()) {
+            return;
+        }
+
+        const qint64 pid = getpid();
+        const QString name = m_name.isEmpty() ? QStringLiteral("helper") : m_name;
+        QJsonArray events;
+        events.append(QJsonObject{
+            {QStringLiteral("name"), QStringLiteral("process_name")},
+            {QStringLiteral("ph"), QStringLiteral("M")},
+            {QStringLiteral("pid"), pid},
+            {QStringLiteral("args"), QJsonObject{{QStringLiteral("name"), name}}},
+        });
+        for (const auto &event : m_events) {
+            QJsonObject object{
+                {QStringLiteral("name"), QString::fromUtf8(event.name)},
+                {QStringLiteral("cat"), QString::fromUtf8(event.category)},
+                {QStringLiteral("ph"), QString(QLatin1Char(event.phase))},
+                {QStringLiteral("ts"), event.timestamp},
+                {QStringLiteral("pid"), pid},
+                {QStringLiteral("tid"), qint64(event.thread)},
+            };
+            if (event.phase == 'X') {
+                object.insert(QStringLiteral("dur"), event.duration);
+            } else if (event.phase == 'i') {
+                object.insert(QStringLiteral("s"), QStringLiteral("t"));
+            }
+            if (!event.args.isEmpty()) {
+                object.insert(QStringLiteral("args"), event.args);
+            }
+            events.append(object);
+        }
+
+        const QDir directory(qEnvironmentVariable("SELENIUM_TRACE_DIR"));
+        directory.mkpath(QStringLiteral("."));
+        QString fileName = QStringLiteral("%1-%2.json").arg(name, QString::number(pid));
+        if (const auto session = qEnvironmentVariable("SELENIUM_TRACE_SESSION"); !session.isEmpty()) {
+            fileName.prepend(session + QLatin1Char('-'));
+        }
+        QSaveFile file(directory.filePath(fileName));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "failed to write trace" << file.fileName() << file.errorString();
+            return;
+        }
+        file.write(QJsonDocument(QJsonObject{{QStringLiteral("traceEvents"), events}}).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+
+    std::mutex m_mutex;
+    QString m_name;
+    std::vector<Event> m_events;
+    std::map<std::string, qint64> m_counters;
+};
+
+Trace &trace()
+{
+    static Trace trace;
+    return trace;
+}
+} // namespace
+
+namespace Tracing
+{
+bool enabled()
+{
+    static const bool enabled = qEnvironmentVariableIsSet("SELENIUM_TRACE_DIR");
+    return enabled;
+}
+
+qint64 now()
+{
+    timespec time{};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return qint64(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+void complete(const char *category, const char *name, qint64 start, qint64 duration, const QJsonObject &args)
+{
+    if (!enabled()) {
+        return;
+    }
+    trace().append({'X', category, name, start, duration, gettid(), args});
+}
+
+void instant(const char *category, const char *name, const QJsonObject &args)
+{
+    if (!enabled()) {
+        return;
+    }
+    trace().append({'i', category, name, now(), 0, gettid(), args});
+}
+
+void count(const char *name, qint64 increment)
+{
+    if (!enabled()) {
+        return;
+    }
+    const qint64 value = trace().count(name, increment);
+    trace().append({'C', "counter", name, now(), 0, gettid(), QJsonObject{{QStringLiteral("value"), value}}});
+}
+} // namespace Tracing
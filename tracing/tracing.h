@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0-only OR GPL-3.0-only OR LicenseRef-KDE-Accepted-GPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#pragma once
+
+#include <QJsonObject>
+
+// Tracing for the helpers. Off unless SELENIUM_TRACE_DIR is set, in which case the events are written as trace-event
+// JSON to $SELENIUM_TRACE_DIR/[$SELENIUM_TRACE_SESSION-]<helper>-<pid>.json when the process exits. The driver sets
+// SELENIUM_TRACE_SESSION for the helpers it runs and merges their files into the trace of the session. Timestamps
+// are microseconds on CLOCK_MONOTONIC, same as the driver's, so everything lines up on one timeline.
+// When off every call boils down to checking a bool.
+namespace Tracing
+{
+[[nodiscard]] bool enabled();
+// Microseconds on CLOCK_MONOTONIC
+[[nodiscard]] qint64 now();
+
+// Something that took duration microseconds from start
+void complete(const char *category, const char *name, qint64 start, qint64 duration, const QJsonObject &args = {});
+// Something that happened just now, e.g. a state change
+void instant(const char *category, const char *name, const QJsonObject &args = {});
+// Increments the counter called name and records its new value
+void count(const char *name, qint64 increment = 1);
+
+// Times its own lifetime
+class Span
+{
+public:
+    Span(const char *category, const char *name)
+        : m_category(category)
+        , m_name(name)
+        , m_start(enabled() ? now() : -1)
+    {
+    }
+
+    ~Span()
+    {
+        if (m_start >= 0) {
+            complete(m_category, m_name, m_start, now() - m_start, m_args);
+        }
+    }
+
+    void setArg(const char *key, const QJsonValue &value)
+    {
+        if (m_start >= 0) {
+            m_args.insert(QLatin1String(key), value);
+        }
+    }
+
+    Q_DISABLE_COPY_MOVE(Span)
+
+private:
+    const char *m_category;
+    const char *m_name;
+    qint64 m_start;
+    QJsonObject m_args;
+};
+} // namespace Tracing
@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include "screencasting.h"
+
+#include <PipeWireSourceStream>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QScreen>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "tracing.h"
+
+using namespace std::chrono_literals;
+
+namespace
+{
+// Streams region and hands the frames to onFrame. Quits the application with an error if that fails.
+void watchRegion(Screencasting *screencasting, const QRect &region, QObject *context, std::function<void(const PipeWireFrame &)> onFrame)
+{
+    auto stream = screencasting->createRegionStream(region, 1, Screencasting::Hidden);
+    QObject::connect(stream, &ScreencastingStream::failed, context, [](const QString &error) {
+        qWarning() << "screencast failed" << error;
+        qGuiApp->exit(1);
+    });
+    QObject::connect(stream, &ScreencastingStream::created, context, [context, onFrame = std::move(onFrame)](quint32 nodeId) {
+        auto source = new PipeWireSourceStream(context);
+        source->setAllowDmaBuf(false); // we want to look at the pixels
+        QObject::connect(source, &PipeWireSourceStream::frameReceived, context, onFrame);
+        if (!source->createStream(nodeId, 0)) {
+            qWarning() << "failed to create pipewire stream" << source->error();
+            qGuiApp->exit(1);
+        }
+    });
+}
+
+// Whether frame shows something else than previous, which is updated to it
+bool frameChanged(const PipeWireFrame &frame, QByteArray &previous)
+{
+    if (frame.damage.has_value() && frame.damage->isEmpty() && !previous.isEmpty()) {
+        return false;
+    }
+    const auto &data = frame.dataFrame;
+    const qsizetype size = qsizetype(data->stride) * data->size.height();
+    if (previous.size() == size && std::memcmp(previous.constData(), data->data, size) == 0) {
+        return false;
+    }
+    previous = QByteArray(static_cast<const char *>(data->data), size);
+    return true;
+}
+} // namespace
+
+// Watches a region of the screen through a screencast stream and reports once nothing changed in it for a while.
+// KWin only sends frames when something got painted, so a quiet region means no frames at all; a frame whose
+// content is identical to the previous one (e.g. a repaint of unchanged content) doesn't count as a change either.
+class StabilityWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    StabilityWatcher(const QRect &region, std::chrono::milliseconds stableFor, std::chrono::milliseconds timeout, QObject *parent = nullptr)
+        : QObject(parent)
+        , m_screencasting(new Screencasting(this))
+    {
+        m_elapsed.start();
+
+        m_stableTimer.setSingleShot(true);
+        m_stableTimer.setInterval(stableFor);
+        connect(&m_stableTimer, &QTimer::timeout, this, [this] {
+            finish(true);
+        });
+
+        m_timeoutTimer.setSingleShot(true);
+        m_timeoutTimer.setInterval(timeout);
+        connect(&m_timeoutTimer, &QTimer::timeout, this, [this] {
+            finish(false);
+        });
+        m_timeoutTimer.start();
+
+        watchRegion(m_screencasting, region, this, [this](const PipeWireFrame &frame) {
+            onFrame(frame);
+        });
+        // A region that is quiet already may never deliver a frame, it is stable once stableFor passed without one
+        m_stableTimer.start();
+    }
+
+private:
+    void onFrame(const PipeWireFrame &frame)
+    {
+        if (!frame.dataFrame) {
+            return; // e.g. a cursor only update
+        }
+        ++m_frames;
+        // The very first frame is the initial state, everything after it is a change.
+        const bool first = m_previous.isEmpty();
+        if (!frameChanged(frame, m_previous)) {
+            return;
+        }
+        if (!first) {
+            ++m_changes;
+            Tracing::count("changed frames");
+            m_lastChange = m_elapsed.elapsed();
+        }
+        m_stableTimer.start();
+    }
+
+    void finish(bool stable)
+    {
+        Tracing::instant("framewatcher", stable ? "stable" : "timeout", {{QStringLiteral("frames"), m_frames}});
+        const QJsonObject result{
+            {QStringLiteral("stable"), stable},
+            {QStringLiteral("elapsed"), m_elapsed.elapsed()},
+            {QStringLiteral("frames"), m_frames},
+            {QStringLiteral("changes"), m_changes},
+            {QStringLiteral("lastChange"), m_lastChange},
+        };
+        printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+        fflush(stdout);
+        qGuiApp->quit();
+    }
+
+    Screencasting *m_screencasting;
+    QElapsedTimer m_elapsed;
+    QTimer m_stableTimer;
+    QTimer m_timeoutTimer;
+    QByteArray m_previous;
+    qint64 m_frames = 0;
+    qint64 m_changes = 0;
+    qint64 m_lastChange = 0;
+};
+
+// Measures how long an application takes to show its reaction to input. The inputsynth performs the actions and tells
+// when the compositor has processed them, the first changed frame after that is the reaction. This is repeated, with
+// the region settling in between, and the distribution printed as JSON.
+class LatencyMeter : public QObject
+{
+    Q_OBJECT
+public:
+    LatencyMeter(const QRect &region,
+                 const QString &actionFile,
+                 int repetitions,
+                 std::chrono::milliseconds settle,
+                 std::chrono::milliseconds timeout,
+                 QObject *parent = nullptr)
+        : QObject(parent)
+        , m_screencasting(new Screencasting(this))
+        , m_actionFile(actionFile)
+        , m_repetitions(repetitions)
+    {
+        // Starts over with every change, the input goes out once the region was quiet for a while
+        m_settleTimer.setSingleShot(true);
+        m_settleTimer.setInterval(settle);
+        connect(&m_settleTimer, &QTimer::timeout, this, &LatencyMeter::inject);
+
+        m_timeoutTimer.setSingleShot(true);
+        m_timeoutTimer.setInterval(timeout);
+        connect(&m_timeoutTimer, &QTimer::timeout, this, [this] {
+            if (m_state == State::Starting || m_state == State::Settling) {
+                qWarning() << "region doesn't settle, sending input regardless";
+                inject();
+                return;
+            }
+            qWarning() << "no reaction to the input";
+            ++m_timeouts;
+            next();
+        });
+        m_timeoutTimer.start();
+
+        watchRegion(m_screencasting, region, this, [this](const PipeWireFrame &frame) {
+            onFrame(frame);
+        });
+        // A region that is quiet already may never deliver a frame, it is stable once stableFor passed without one
+        m_stableTimer.start();
+    }
+
+private:
+    enum class State {
+        Starting, // waiting for the first frame
+        Settling,
+        Injecting, // the inputsynth runs, we don't know when the input happened yet
+        Measuring,
+    };
+
+    void onFrame(const PipeWireFrame &frame)
+    {
+        if (!frame.dataFrame) {
+            return; // e.g. a cursor only update
+        }
+        const qint64 time = frameTime(frame);
+        if (!frameChanged(frame, m_previous)) {
+            return;
+        }
+        switch (m_state) {
+        case State::Starting:
+            m_state = State::Settling;
+            m_settleTimer.start();
+            m_timeoutTimer.start();
+            return;
+        case State::Settling:
+            m_settleTimer.start();
+            return;
+        case State::Injecting:
+            m_pendingChanges.push_back(time);
+            return;
+        case State::Measuring:
+            if (time >= m_inputTime) {
+                record(time - m_inputTime);
+            }
+            return;
+        }
+    }
+
+    // When the frame got presented, in microseconds on CLOCK_MONOTONIC like the times the inputsynth reports
+    qint64 frameTime(const PipeWireFrame &frame)
+    {
+        const qint64 received = Tracing::now();
+        // KWin stamps frames with their presentation time. Without a plausible stamp the time the frame got here has
+        // to do, which includes the way through PipeWire.
+        if (frame.presentationTimestamp.has_value()) {
+            const qint64 presented = std::chrono::duration_cast<std::chrono::microseconds>(*frame.presentationTimestamp).count();
+            if (presented > 0 && std::abs(received - presented) < std::chrono::microseconds(1s).count()) {
+                return presented;
+            }
+        }
+        m_receiptTimes = true;
+        return received;
+    }
+
+    void inject()
+    {
+        m_state = State::Injecting;
+        m_pendingChanges.clear();
+        m_timeoutTimer.start();
+
+        auto process = new QProcess(this);
+        m_process = process;
+        connect(process, &QProcess::finished, this, [this, process](int exitCode) {
+            process->deleteLater();
+            if (process != m_process) {
+                return; // timed out already
+            }
+            m_process = nullptr;
+            if (exitCode != 0) {
+                qWarning() << "inputsynth failed" << process->readAllStandardError();
+                qGuiApp->exit(1);
+                return;
+            }
+            // The input that counts is the last one, what comes before it (e.g. moving the pointer) is setup
+            const auto lines = QString::fromUtf8(process->readAllStandardOutput()).split(QLatin1Char('\n'), Qt::SkipEmptyParts);
+            for (const auto &line : lines) {
+                if (line.startsWith(QLatin1String("performed "))) {
+                    m_inputTime = line.mid(10).toLongLong();
+                }
+            }
+            m_state = State::Measuring;
+            const auto change = std::ranges::find_if(m_pendingChanges, [this](qint64 time) {
+                return time >= m_inputTime;
+            });
+            if (change != m_pendingChanges.end()) {
+                record(*change - m_inputTime);
+            }
+        });
+        connect(process, &QProcess::errorOccurred, this, [](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart) {
+                qWarning() << "failed to start the inputsynth";
+                qGuiApp->exit(1);
+            }
+        });
+        process->start(QStringLiteral("selenium-webdriver-at-spi-inputsynth"), {QStringLiteral("--timestamps"), m_actionFile});
+    }
+
+    void record(qint64 latency)
+    {
+        Tracing::complete("framewatcher", "latency", m_inputTime, latency);
+        m_latencies.push_back(latency);
+        next();
+    }
+
+    void next()
+    {
+        m_process = nullptr;
+        if (qsizetype(m_latencies.size()) + m_timeouts >= m_repetitions) {
+            finish();
+            return;
+        }
+        m_state = State::Settling;
+        m_settleTimer.start();
+        m_timeoutTimer.start();
+    }
+
+    void finish()
+    {
+        m_settleTimer.stop();
+        m_timeoutTimer.stop();
+        std::ranges::sort(m_latencies);
+        auto milliseconds = [](qint64 microseconds) {
+            return microseconds / 1000.0;
+        };
+        // Nearest rank
+        auto percentile = [this, &milliseconds](double fraction) -> QJsonValue {
+            if (m_latencies.empty()) {
+                return QJsonValue::Null;
+            }
+            const auto rank = std::max<qsizetype>(1, qsizetype(std::ceil(fraction * m_latencies.size())));
+            return milliseconds(m_latencies.at(rank - 1));
+        };
+
+        QJsonArray latencies;
+        qint64 total = 0;
+        for (const auto &latency : m_latencies) {
+            latencies.append(milliseconds(latency));
+            total += latency;
+        }
+        const QJsonObject result{
+            {QStringLiteral("repetitions"), m_repetitions},
+            {QStringLiteral("timeouts"), m_timeouts},
+            {QStringLiteral("latencies"), latencies},
+            {QStringLiteral("min"), percentile(0)},
+            {QStringLiteral("median"), percentile(0.5)},
+            {QStringLiteral("p90"), percentile(0.9)},
+            {QStringLiteral("p99"), percentile(0.99)},
+            {QStringLiteral("max"), percentile(1)},
+            {QStringLiteral("mean"), m_latencies.empty() ? QJsonValue::Null : QJsonValue(milliseconds(total) / m_latencies.size())},
+            {QStringLiteral("clock"), m_receiptTimes ? QStringLiteral("receipt") : QStringLiteral("presentation")},
+        };
+        printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+        fflush(stdout);
+        qGuiApp->quit();
+    }
+
+    Screencasting *m_screencasting;
+    const QString m_actionFile;
+    const int m_repetitions;
+    State m_state = State::Starting;
+    QTimer m_settleTimer;
+    QTimer m_timeoutTimer;
+    QByteArray m_previous;
+    QProcess *m_process = nullptr; // the inputsynth performing the current repetition
+    std::vector<qint64> m_pendingChanges; // times of the changes while the inputsynth ran
+    qint64 m_inputTime = 0;
+    std::vector<qint64> m_latencies; // microseconds
+    int m_timeouts = 0;
+    bool m_receiptTimes = false;
+};
+
+int main(int argc, char **argv)
+{
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Waits until the screen stops changing. Prints the result as JSON.\n"
+                                                    "With --latency measures how long it takes the screen to react to the actions instead."));
+    QCommandLineOption stableOption(QStringLiteral("stable-for"), QStringLiteral("how long nothing may change"), QStringLiteral("ms"), QStringLiteral("500"));
+    QCommandLineOption timeoutOption(QStringLiteral("timeout"), QStringLiteral("give up after this long"), QStringLiteral("ms"), QStringLiteral("10000"));
+    QCommandLineOption regionOption(QStringLiteral("region"), QStringLiteral("only watch this region (logical coordinates)"), QStringLiteral("x,y,width,height"));
+    QCommandLineOption latencyOption(QStringLiteral("latency"), QStringLiteral("inputsynth action file to measure the reaction to"), QStringLiteral("file"));
+    QCommandLineOption repetitionsOption(QStringLiteral("repetitions"), QStringLiteral("how often to measure the latency"), QStringLiteral("count"), QStringLiteral("20"));
+    parser.addHelpOption();
+    parser.addOption(stableOption);
+    parser.addOption(timeoutOption);
+    parser.addOption(regionOption);
+    parser.addOption(latencyOption);
+    parser.addOption(repetitionsOption);
+    parser.process(app);
+
+    QRect region;
+    if (parser.isSet(regionOption)) {
+        static const QRegularExpression expression(QStringLiteral("^(-?\\d+),(-?\\d+),(\\d+),(\\d+)$"));
+        const auto match = expression.match(parser.value(regionOption));
+        if (!match.hasMatch()) {
+            qWarning() << "invalid region" << parser.value(regionOption);
+            return 1;
+        }
+        region = QRect(match.captured(1).toInt(), match.captured(2).toInt(), match.captured(3).toInt(), match.captured(4).toInt());
+    } else {
+        for (auto screen : qGuiApp->screens()) {
+            region |= screen->geometry();
+        }
+    }
+
+    const std::chrono::milliseconds stableFor(parser.value(stableOption).toLongLong());
+    const std::chrono::milliseconds timeout(parser.value(timeoutOption).toLongLong());
+    std::unique_ptr<QObject> watcher;
+    if (parser.isSet(latencyOption)) {
+        watcher = std::make_unique<LatencyMeter>(region, parser.value(latencyOption), parser.value(repetitionsOption).toInt(), stableFor, timeout);
+    } else {
+        watcher = std::make_unique<StabilityWatcher>(region, stableFor, timeout);
+    }
+    return app.exec();
+}
+
+#include "framewatcher.moc"
@@ -12,11 +12,16 @@
 #include <QFile>
 #include <QGuiApplication>
 #include <QLoggingCategory>
+#include <QMetaEnum>
 #include <QScreen>
 #include <QThread>
 #include <QTimer>
 
+#include <cerrno>
 #include <csignal>
+#include <cstring>
+
+#include "tracing.h"
 
 using namespace std::chrono_literals;
 using namespace Qt::StringLiterals;
@@ -28,18 +33,19 @@ class Context : public QObject
 public:
     inline static Context *self = nullptr;
 
-    static void reset(const QString &output)
+    static void reset(const QString &output, pid_t notifyPid)
     {
         if (self) {
             self->deleteLater(); // careful, delete later, we get called from a slot!
         }
-        self = new Context(output, qGuiApp);
+        self = new Context(output, notifyPid, qGuiApp);
     }
 
 private:
-    Context(const QString &output, QObject *parent = nullptr)
+    Context(const QString &output, pid_t notifyPid, QObject *parent = nullptr)
         : QObject(parent)
         , m_output(output)
+        , m_notifyPid(notifyPid)
         , m_record([this] {
             auto record = new PipeWireRecord(this);
             record->setOutput(m_output);
@@ -52,6 +58,7 @@ private:
             connect(record, &PipeWireRecord::stateChanged, qGuiApp, [record, this] {
                 auto state = record->state();
                 qDebug() << "state changed" << state;
+                Tracing::instant("recorder", "stateChanged", {{u"state"_s, QString::fromLatin1(QMetaEnum::fromType<PipeWireRecord::State>().valueToKey(state))}});
                 switch (state) {
                 case PipeWireRecord::Idle:
                     qDebug() << "idle!" << m_hasStarted;
@@ -69,6 +76,10 @@ private:
                         qWarning() << "Could not create started marker file!";
                         qGuiApp->exit(4);
                     }
+                    // Tell whoever is waiting on us that we are up, so they needn't poll the marker.
+                    if (m_notifyPid > 0 && ::kill(m_notifyPid, SIGUSR1) != 0) {
+                        qWarning() << "Could not notify" << m_notifyPid << strerror(errno);
+                    }
                     break;
                 }
                 case PipeWireRecord::Rendering:
@@ -78,7 +89,7 @@ private:
                     if (!m_hasStarted && retryCount > 0) {
                         qWarning() << "Got into rendering state without having started recording! Trying once again...";
                         QThread::sleep(1s); // random amount of time to wait for pipewire to be ready
-                        Context::reset(m_output);
+                        Context::reset(m_output, m_notifyPid);
                         return;
                     }
                     qDebug() << "rendering...";
@@ -113,7 +124,8 @@ private:
                     return;
                 }
                 qWarning() << "Timeout waiting for screencasting to start!. Trying again...";
-                Context::reset(m_output);
+                Tracing::instant("recorder", "startTimeout");
+                Context::reset(m_output, m_notifyPid);
             });
             timer->start();
             return timer;
@@ -126,6 +138,7 @@ private:
 
     bool m_hasStarted = false;
     QString m_output;
+    pid_t m_notifyPid = 0;
     PipeWireRecord *m_record;
     Screencasting *m_screencasting;
     QTimer *m_startTimer;
@@ -137,11 +150,13 @@ int main(int argc, char **argv)
 
     QCommandLineParser parser;
     QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("path for the generated video"), QStringLiteral("path"));
+    QCommandLineOption notifyPidOption(QStringLiteral("notify-pid"), QStringLiteral("process to send SIGUSR1 once recording has started"), QStringLiteral("pid"));
     parser.addHelpOption();
     parser.addOption(outputOption);
+    parser.addOption(notifyPidOption);
     parser.process(app);
 
-    Context::reset(parser.value(outputOption));
+    Context::reset(parser.value(outputOption), parser.value(notifyPidOption).toInt());
 
     KSignalHandler::self()->watchSignal(SIGTERM);
     KSignalHandler::self()->watchSignal(SIGINT);
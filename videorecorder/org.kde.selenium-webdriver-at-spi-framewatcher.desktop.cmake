@@ -0,0 +1,8 @@
+# SPDX-License-Identifier: CC0-1.0
+# SPDX-FileCopyrightText: 2026 agent <agent@local>
+[Desktop Entry]
+Name=Authorized frame watcher
+NoDisplay=true
+Exec=${CMAKE_INSTALL_PREFIX}/bin/selenium-webdriver-at-spi-framewatcher
+Type=Application
+X-KDE-Wayland-Interfaces=zkde_screencast_unstable_v1